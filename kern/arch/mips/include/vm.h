@@ -66,6 +66,7 @@
  * a valid address, and will make a *huge* mess if you scribble on it.
  */
 #define PADDR_TO_KVADDR(paddr) ((paddr)+MIPS_KSEG0)
+#define KVADDR_TO_PADDR(vaddr) ((vaddr)-MIPS_KSEG0)
 
 /*
  * The top of user space. (Actually, the address immediately above the
@@ -114,15 +115,19 @@ paddr_t ram_getfirstfree(void);
  * TLB shootdown bits.
  *
  * We'll take up to 16 invalidations before just flushing the whole TLB.
+ *
+ * Translations are tagged with an address space ID that differs from
+ * CPU to CPU, so each target gets the ID the address space has there.
+ * (The address space itself may be gone by the time the IPI lands.)
  */
 
 struct tlbshootdown {
-	/*
-	 * Change this to what you need for your VM design.
-	 */
-	int ts_placeholder;
+	unsigned ts_asid;		/* target's ID for it, with generation */
+	vaddr_t ts_vaddr;		/* page, or TLBSHOOTDOWN_ALL */
 };
 
+#define TLBSHOOTDOWN_ALL 1	/* not page-aligned, so never a real page */
+
 #define TLBSHOOTDOWN_MAX 16
 
 
@@ -31,12 +31,14 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
 #include <file_syscalls.h>
 #include <proc_syscalls.h>
+#include <vm_syscalls.h>
 
 
 /*
@@ -83,6 +85,12 @@ syscall(struct trapframe *tf)
     int callno;
     int32_t retval;
     int64_t retval_big;
+    vaddr_t oldbreak, mapaddr;
+    int mapfd;
+    off_t mapoffset;
+    off_t iopos;
+    size_t copylen;
+    unsigned copyflags;
     int err;
 
     KASSERT(curthread != NULL);
@@ -113,6 +121,11 @@ syscall(struct trapframe *tf)
                  (userptr_t)tf->tf_a1);
         break;
 
+        case SYS_nanosleep:
+        err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+                    (userptr_t)tf->tf_a1);
+        break;
+
         case SYS_open:
         err = sys_open((userptr_t)tf->tf_a0, (int)tf->tf_a1, &retval);
         break;
@@ -125,6 +138,48 @@ syscall(struct trapframe *tf)
         err = sys_read((int)tf->tf_a0, (userptr_t)tf->tf_a1, (size_t)tf->tf_a2, &retval);
         break;
 
+        case SYS_pwrite:
+        /* The offset is 64-bit aligned, so it skips a3 for the stack. */
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &iopos,
+                     sizeof(iopos));
+        if (!err) {
+            err = sys_pwrite((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+                             (size_t)tf->tf_a2, iopos, &retval);
+        }
+        break;
+
+        case SYS_pread:
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &iopos,
+                     sizeof(iopos));
+        if (!err) {
+            err = sys_pread((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+                            (size_t)tf->tf_a2, iopos, &retval);
+        }
+        break;
+
+        case SYS_copy_file_range:
+        /* len and flags are on the stack. */
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &copylen,
+                     sizeof(copylen));
+        if (!err) {
+            err = copyin((const_userptr_t)(tf->tf_sp + 20), &copyflags,
+                         sizeof(copyflags));
+        }
+        if (!err) {
+            err = sys_copy_file_range((int)tf->tf_a0, (userptr_t)tf->tf_a1,
+                                      (int)tf->tf_a2, (userptr_t)tf->tf_a3,
+                                      copylen, copyflags, &retval);
+        }
+        break;
+
+        case SYS_writev:
+        err = sys_writev((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
+        break;
+
+        case SYS_readv:
+        err = sys_readv((int)tf->tf_a0, (userptr_t)tf->tf_a1, (int)tf->tf_a2, &retval);
+        break;
+
         case SYS_close:
         err = sys_close((int)tf->tf_a0);
         break;
@@ -163,6 +218,40 @@ syscall(struct trapframe *tf)
         err = sys_waitpid((pid_t)tf->tf_a0, (int*)tf->tf_a1, (int)tf->tf_a2, &retval);
         break;
 
+        case SYS_sbrk:
+        err = sys_sbrk((intptr_t)tf->tf_a0, &oldbreak);
+        retval = (int32_t)oldbreak;
+        break;
+
+        case SYS_mmap:
+        /* fd and offset are on the stack; offset is 64-bit aligned. */
+        err = copyin((const_userptr_t)(tf->tf_sp + 16), &mapfd,
+                     sizeof(mapfd));
+        if (!err) {
+            err = copyin((const_userptr_t)(tf->tf_sp + 24), &mapoffset,
+                         sizeof(mapoffset));
+        }
+        if (!err) {
+            err = sys_mmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+                           (int)tf->tf_a2, (int)tf->tf_a3, mapfd, mapoffset,
+                           &mapaddr);
+            retval = (int32_t)mapaddr;
+        }
+        break;
+
+        case SYS_munmap:
+        err = sys_munmap((userptr_t)tf->tf_a0, (size_t)tf->tf_a1);
+        break;
+
+        case SYS_msync:
+        err = sys_msync((userptr_t)tf->tf_a0, (size_t)tf->tf_a1,
+                        (int)tf->tf_a2);
+        break;
+
+        case SYS_vmstat:
+        err = sys_vmstat((userptr_t)tf->tf_a0);
+        break;
+
         default:
         kprintf("Unknown syscall %d\n", callno);
         err = ENOSYS;
@@ -38,6 +38,7 @@
 #include <mips/tlb.h>
 #include <addrspace.h>
 #include <vm.h>
+#include <pagecache.h>
 
 /*
  * Dumb MIPS-only "VM system" that is intended to only be just barely
@@ -64,6 +65,9 @@
  */
 static struct spinlock stealmem_lock = SPINLOCK_INITIALIZER;
 
+/* Pages stolen so far; nothing is ever given back. */
+static unsigned long dumbvm_npages;
+
 void
 vm_bootstrap(void)
 {
@@ -99,6 +103,9 @@ getppages(unsigned long npages)
 	spinlock_acquire(&stealmem_lock);
 
 	addr = ram_stealmem(npages);
+	if (addr != 0) {
+		dumbvm_npages += npages;
+	}
 
 	spinlock_release(&stealmem_lock);
 	return addr;
@@ -130,9 +137,16 @@ unsigned
 int
 coremap_used_bytes() {
 
-	/* dumbvm doesn't track page allocations. Return 0 so that khu works. */
+	/* Everything dumbvm has handed out, since it never frees anything. */
 
-	return 0;
+	return dumbvm_npages * PAGE_SIZE;
+}
+
+int
+vm_getstats(struct vmstat *vs)
+{
+	(void)vs;
+	return ENOSYS;
 }
 
 void
@@ -142,12 +156,17 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+bool
+vm_idle(void)
+{
+	return false;
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
 	vaddr_t vbase1, vtop1, vbase2, vtop2, stackbase, stacktop;
 	paddr_t paddr;
-	int i;
 	uint32_t ehi, elo;
 	struct addrspace *as;
 	int spl;
@@ -222,25 +241,21 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	/*
+	 * This was a TLB miss, and as_activate flushes the TLB, so there
+	 * is no entry for this page to collide with. Let the processor
+	 * pick a slot to replace rather than hunting for a free one.
+	 */
+	ehi = faultaddress;
+	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
+	DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
-
-	for (i=0; i<NUM_TLB; i++) {
-		tlb_read(&ehi, &elo, i);
-		if (elo & TLBLO_VALID) {
-			continue;
-		}
-		ehi = faultaddress;
-		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
-		DEBUG(DB_VM, "dumbvm: 0x%x -> 0x%x\n", faultaddress, paddr);
-		tlb_write(ehi, elo, i);
-		splx(spl);
-		return 0;
-	}
-
-	kprintf("dumbvm: Ran out of TLB entries - cannot handle page fault\n");
+	tlb_random(ehi, elo);
 	splx(spl);
-	return EFAULT;
+
+	return 0;
 }
 
 struct addrspace *
@@ -392,6 +407,80 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+	/* There's no room for a heap in dumbvm's fixed layout. */
+	(void)as;
+	(void)amount;
+	(void)oldbreak;
+	return ENOSYS;
+}
+
+int
+as_define_fileregion(struct addrspace *as, vaddr_t vaddr, size_t sz,
+		     struct vnode *vn, off_t offset, size_t filesize,
+		     int readable, int writeable, int executable)
+{
+	/* Everything is loaded up front; load_elf falls back to that. */
+	(void)as;
+	(void)vaddr;
+	(void)sz;
+	(void)vn;
+	(void)offset;
+	(void)filesize;
+	(void)readable;
+	(void)writeable;
+	(void)executable;
+	return ENOSYS;
+}
+
+void
+pagecache_purge(struct vnode *vn)
+{
+	/* Nothing is cached. */
+	(void)vn;
+}
+
+void
+pagecache_purgefs(struct fs *fs)
+{
+	/* Nothing is cached. */
+	(void)fs;
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int prot, int flags,
+	struct vnode *vn, off_t offset)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	(void)prot;
+	(void)flags;
+	(void)vn;
+	(void)offset;
+	return ENOSYS;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len)
+{
+	(void)as;
+	(void)addr;
+	(void)len;
+	return ENOSYS;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
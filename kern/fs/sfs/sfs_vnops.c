@@ -232,14 +232,16 @@ sfs_fsync(struct vnode *v)
 }
 
 /*
- * Called for mmap().
+ * Called for mmap(). Any regular file can be mapped; the VM system
+ * pages it in and out with sfs_read and sfs_write.
  */
 static
 int
-sfs_mmap(struct vnode *v   /* add stuff as needed */)
+sfs_mmap(struct vnode *v, int prot)
 {
 	(void)v;
-	return ENOSYS;
+	(void)prot;
+	return 0;
 }
 
 /*
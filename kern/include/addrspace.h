@@ -35,12 +35,53 @@
  */
 
 
+#include <array.h>
 #include <vm.h>
+#include <platform/maxcpus.h>
 #include "opt-dumbvm.h"
 
 struct vnode;
+struct lock;
+struct pagetable;
 
 
+#if !OPT_DUMBVM
+/*
+ * A region is a range of the address space the program may use, and
+ * what it may do with it. Pages within a region are allocated on
+ * first touch, and either read in from the file the region maps or,
+ * past its first rg_filesize bytes, zero-filled.
+ */
+struct region {
+        vaddr_t rg_base;                /* Page-aligned start. */
+        size_t rg_npages;               /* Length in pages. */
+        int rg_perms;                   /* RG_READ | RG_WRITE | RG_EXEC */
+        int rg_flags;                   /* RGF_* */
+        struct vnode *rg_vnode;         /* File mapped here, or NULL. */
+        off_t rg_offset;                /* Where rg_base is in the file. */
+        size_t rg_filesize;             /* Bytes from rg_base in the file. */
+
+        /* Fault-around; see vm_fault. */
+        vaddr_t rg_fanext;              /* Where a sequential walk faults next. */
+        unsigned rg_fawindow;           /* Pages mapped by the last fault. */
+        unsigned rg_faahead;            /* ...of which mapped ahead of time. */
+};
+
+#define RG_READ         4
+#define RG_WRITE        2
+#define RG_EXEC         1
+
+#define RGF_MMAP        1               /* Made by mmap; munmap may remove. */
+#define RGF_SHARED      2               /* Writes go back to rg_vnode. */
+
+#ifndef ASINLINE
+#define ASINLINE INLINE
+#endif
+
+DECLARRAY(region, ASINLINE);
+DEFARRAY(region, ASINLINE);
+#endif
+
 /*
  * Address space - data structure associated with the virtual memory
  * space of a process.
@@ -58,10 +99,30 @@ struct addrspace {
         size_t as_npages2;
         paddr_t as_stackpbase;
 #else
-        /* Put stuff here for your VM system */
+        struct lock *as_lock;           /* Protects everything below. */
+        struct pagetable *as_pt;        /* Page table. */
+        struct regionarray as_regions;  /* Defined regions, by address. */
+        struct region *as_lastregion;   /* Last one as_findregion found. */
+        struct region *as_heap;         /* Moved by sbrk; after the data. */
+        bool as_loading;                /* Between prepare/complete_load. */
+
+        /* TLB address space ID on each CPU; only that CPU touches it. */
+        unsigned as_asid[MAXCPUS];
 #endif
 };
 
+#if !OPT_DUMBVM
+/* The stack region; pages are only allocated as the stack grows into them. */
+#define VM_STACKPAGES   1024
+
+/*
+ * Find the region containing VA, or NULL. Call with as_lock held.
+ * Faults tend to hit the same region as last time, so that's checked
+ * first; otherwise it's a binary search.
+ */
+struct region *as_findregion(struct addrspace *as, vaddr_t va);
+#endif
+
 /*
  * Functions in addrspace.c:
  *
@@ -89,6 +150,12 @@ struct addrspace {
  *    as_define_region - set up a region of memory within the address
  *                space.
  *
+ *    as_define_fileregion - set up a region whose first FILESIZE bytes
+ *                are read in from a file on first touch, and the rest
+ *                zero-filled. Returns EINVAL if the file can't be lined
+ *                up with the pages, and ENOSYS if the VM system can't
+ *                do it at all.
+ *
  *    as_prepare_load - this is called before actually loading from an
  *                executable into the address space.
  *
@@ -99,6 +166,21 @@ struct addrspace {
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
  *
+ *    as_sbrk   - move the end of the heap by AMOUNT bytes, a multiple
+ *                of the page size, handing back the old end. Pages
+ *                given back are freed right away.
+ *
+ *    as_mmap   - add a region of LEN bytes mapping VN (or zero-filled,
+ *                if VN is NULL) from OFFSET, at *ADDR if MAP_FIXED is
+ *                set or wherever there's room otherwise. The caller
+ *                checks VN may be mapped; the region keeps a reference.
+ *
+ *    as_munmap - remove the mmap regions in a range, writing back
+ *                shared pages that have been changed.
+ *
+ *    as_msync  - write back changed pages of shared mappings in a
+ *                range.
+ *
  * Note that when using dumbvm, addrspace.c is not used and these
  * functions are found in dumbvm.c.
  */
@@ -114,9 +196,23 @@ int               as_define_region(struct addrspace *as,
                                    int readable,
                                    int writeable,
                                    int executable);
+int               as_define_fileregion(struct addrspace *as,
+                                       vaddr_t vaddr, size_t sz,
+                                       struct vnode *vn, off_t offset,
+                                       size_t filesize,
+                                       int readable,
+                                       int writeable,
+                                       int executable);
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_sbrk(struct addrspace *as, intptr_t amount,
+                          vaddr_t *oldbreak);
+int               as_mmap(struct addrspace *as, vaddr_t *addr, size_t len,
+                          int prot, int flags, struct vnode *vn,
+                          off_t offset);
+int               as_munmap(struct addrspace *as, vaddr_t addr, size_t len);
+int               as_msync(struct addrspace *as, vaddr_t addr, size_t len);
 
 
 /*
@@ -0,0 +1,113 @@
+#ifndef _COREMAP_H_
+#define _COREMAP_H_
+
+#include <vm.h>
+
+struct addrspace;
+
+/*
+ * The coremap keeps one entry per physical page of RAM, recording
+ * what the page is being used for. Kernel pages come from the bottom
+ * of memory and user pages from the top, so that user pages coming
+ * and going don't break up the runs multi-page kmallocs need.
+ */
+
+/* Page states */
+#define CM_FREE     0               /* Not in use. */
+#define CM_FIXED    1               /* Kernel image or coremap; never freed. */
+#define CM_KERNEL   2               /* Allocated with alloc_kpages. */
+#define CM_USER     3               /* Holds a page of a user address space. */
+#define CM_ZERO     4               /* Free and zeroed, in a CPU's pool. */
+
+#define CM_ZPOOLPAGES   16          /* Pre-zeroed pages kept per CPU. */
+
+/* Page flags */
+#define CMF_REFERENCED  0x01        /* Mapped into a TLB since the clock passed. */
+
+struct cm_entry {
+    struct addrspace *cm_as;        /* Owning address space, NULL if shared. */
+    vaddr_t cm_va;                  /* User address the page is mapped at. */
+    unsigned cm_slot;               /* Swap slot with a clean copy, or 0. */
+    uint16_t cm_npages;             /* Length of a kernel run (first page). */
+    uint16_t cm_refcount;           /* Page tables mapping a user page. */
+    uint8_t cm_state;               /* One of the CM_* states. */
+    uint8_t cm_flags;               /* CMF_* flags. */
+};
+
+/* Set up the coremap. Safe to call more than once. */
+void coremap_bootstrap(void);
+
+/*
+ * Allocate a physical page for user address VA in address space AS.
+ * The page is not zeroed. If memory is short this pages something
+ * out, so the caller must not hold any address space lock. Returns 0
+ * if there is no page to be had.
+ */
+paddr_t coremap_alloc_upage(struct addrspace *as, vaddr_t va);
+
+/*
+ * Like coremap_alloc_upage, but the page is zero-filled. It comes from
+ * this CPU's pool of pages zeroed while the CPU was idle if there is
+ * one there, and is zeroed on the spot otherwise.
+ */
+paddr_t coremap_alloc_zeroed_upage(struct addrspace *as, vaddr_t va);
+
+/*
+ * Zero a free page into this CPU's pool, if it has room and memory
+ * isn't short. Returns false if there was nothing to do. Called from
+ * the idle loop, with interrupts off, so it does one page at a time.
+ */
+bool coremap_zeroidle(void);
+
+/* Print each CPU's pool size and hit and miss counts. */
+void coremap_printzpoolstats(void);
+
+/*
+ * Print how often compaction (moving user pages to make room for a
+ * multi-page alloc_kpages) succeeded, and how many pages it moved.
+ */
+void coremap_printcompactstats(void);
+
+/*
+ * User pages are shared copy-on-write after fork, so they carry a
+ * reference count. coremap_alloc_upage returns a page with a count of
+ * one; coremap_share adds a reference; coremap_free_upage drops one
+ * and frees the page (and its swap slot) when the last goes away.
+ *
+ * A shared page has no owner, which keeps it away from pageout.
+ * coremap_claim makes AS the owner again once it's the only user.
+ */
+void coremap_share(paddr_t pa);
+void coremap_free_upage(paddr_t pa);
+void coremap_claim(paddr_t pa, struct addrspace *as, vaddr_t va);
+
+/* Current reference count of a user page. */
+unsigned coremap_refcount(paddr_t pa);
+
+/* Mark a user page as recently used. */
+void coremap_touch(paddr_t pa);
+
+/*
+ * The swap slot holding a clean copy of a user page, or 0. Setting a
+ * slot hands the coremap the caller's reference to it; taking it
+ * hands the reference back and leaves 0, atomically, so of several
+ * address spaces sharing the page only one gets it.
+ */
+unsigned coremap_getslot(paddr_t pa);
+void coremap_setslot(paddr_t pa, unsigned slot);
+unsigned coremap_takeslot(paddr_t pa);
+
+/* Number of pages managed by the coremap. */
+unsigned coremap_npages(void);
+
+/* Number of free pages, counting pooled ones. */
+unsigned coremap_freepages(void);
+
+/*
+ * Advance the clock hand to the next user page that has a single
+ * owner and hasn't been used since the hand last passed it. Returns
+ * false if there is no such page.
+ */
+bool coremap_nextvictim(struct addrspace **as, vaddr_t *va, paddr_t *pa);
+
+#endif /* _COREMAP_H_ */
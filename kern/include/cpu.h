@@ -83,10 +83,18 @@ struct cpu {
 	 * The contents of struct tlbshootdown are also machine-
 	 * dependent and might reasonably be either an address space
 	 * and vaddr pair, or a paddr, or something else.
+	 *
+	 * If more requests arrive than fit, c_shootdownall is set
+	 * instead and the whole TLB is flushed.
+	 *
+	 * c_shootdowndone counts the times the queue has been
+	 * processed, so a sender can wait for its requests to be done.
 	 */
 	uint32_t c_ipi_pending;		/* One bit for each IPI number */
 	struct tlbshootdown c_shootdown[TLBSHOOTDOWN_MAX];
 	unsigned c_numshootdown;
+	bool c_shootdownall;		/* Queue overflowed; flush it all */
+	unsigned c_shootdowndone;	/* Times the queue was processed */
 	struct spinlock c_ipi_lock;
 
 	/*
@@ -157,6 +165,12 @@ void cpu_halt(void);
  * ipi_broadcast sends an IPI to all CPUs except the current one.
  * ipi_tlbshootdown is like ipi_send but carries TLB shootdown data.
  *
+ * To send several shootdowns with one IPI, queue them with
+ * ipi_tlbshootdown_queue and then call ipi_tlbshootdown_send, which
+ * returns a ticket; ipi_tlbshootdown_wait waits until the target has
+ * done everything queued before the ticket. Don't wait with a spinlock
+ * held or interrupts off, as the target may be waiting for us.
+ *
  * interprocessor_interrupt is called on the target CPU when an IPI is
  * received.
  */
@@ -170,6 +184,13 @@ void cpu_halt(void);
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
 void ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping);
+void ipi_tlbshootdown_queue(struct cpu *target,
+			    const struct tlbshootdown *mapping);
+unsigned ipi_tlbshootdown_send(struct cpu *target);
+void ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket);
+
+/* Look up a CPU by its c_number. */
+struct cpu *cpu_bynumber(unsigned num);
 
 void interprocessor_interrupt(void);
 
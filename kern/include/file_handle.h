@@ -1,9 +1,13 @@
 #ifndef _FILE_HANDLE_H_
 #define _FILE_HANDLE_H_
 
+struct iovec;
 struct lock;
 struct vnode;
 
+/* Largest chunk fh_copy moves at a time. */
+#define FH_COPYCHUNK (64 * 1024)
+
 struct file_handle {
     struct vnode *fh_file_obj;  /* The actual file object. */
     off_t fh_offset;            /* Offset into the file. */
@@ -20,11 +24,36 @@ int fh_create(struct file_handle **fh, char *path, int flags);
  */
 void fh_destroy(struct file_handle *fh);
 
-/* Writes the buffer buf of length buflen to the file. */
-int fh_write(struct file_handle *fh, void *buf, size_t buflen, int *size);
+/* Writes the user buffer buf of length buflen to the file. */
+int fh_write(struct file_handle *fh, userptr_t buf, size_t buflen, int *size);
+
+/* Reads buflen number of bytes into the user buffer buf from the file. */
+int fh_read(struct file_handle *fh, userptr_t buf, size_t buflen, int *size);
+
+/*
+ * Write or read the iovcnt user buffers in iov, len bytes in all, as a
+ * single write or read. iov is used up in the process.
+ */
+int fh_writev(struct file_handle *fh, struct iovec *iov, unsigned iovcnt,
+              size_t len, int *size);
+int fh_readv(struct file_handle *fh, struct iovec *iov, unsigned iovcnt,
+             size_t len, int *size);
 
-/* Reads buflen number of bytes into buf from the file. */
-int fh_read(struct file_handle *fh, void *buf, size_t buflen, int *size);
+/*
+ * Write or read at offset pos, without touching the handle's offset
+ * or taking its lock.
+ */
+int fh_pwrite(struct file_handle *fh, userptr_t buf, size_t buflen, off_t pos,
+              int *size);
+int fh_pread(struct file_handle *fh, userptr_t buf, size_t buflen, off_t pos,
+             int *size);
+
+/*
+ * Copy up to len bytes from in to out inside the kernel, at *inpos and
+ * *outpos, or at the handles' own offsets where those are NULL.
+ */
+int fh_copy(struct file_handle *in, off_t *inpos, struct file_handle *out,
+            off_t *outpos, size_t len, int *size);
 
 /* Seek to a new position based on pos and whence. */
 int fh_lseek(struct file_handle *fh, off_t pos, int whence, off_t *new_pos);
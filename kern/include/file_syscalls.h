@@ -4,6 +4,15 @@
 int sys_open(userptr_t user_filename_ptr, int flags, int *fd);
 int sys_write(int fd, userptr_t user_buf_ptr, size_t buflen, int *size);
 int sys_read(int fd, userptr_t user_buf_ptr, size_t buflen, int *size);
+int sys_writev(int fd, userptr_t user_iov_ptr, int iovcnt, int *size);
+int sys_readv(int fd, userptr_t user_iov_ptr, int iovcnt, int *size);
+int sys_pwrite(int fd, userptr_t user_buf_ptr, size_t buflen, off_t pos,
+               int *size);
+int sys_pread(int fd, userptr_t user_buf_ptr, size_t buflen, off_t pos,
+              int *size);
+int sys_copy_file_range(int infd, userptr_t user_inpos_ptr, int outfd,
+                        userptr_t user_outpos_ptr, size_t len, unsigned flags,
+                        int *size);
 int sys_close(int fd);
 int sys_lseek(int fd, off_t pos, int whence, off_t *new_pos);
 int sys_dup2(int oldfd, int newfd);
@@ -0,0 +1,29 @@
+#ifndef _KERN_MMAN_H_
+#define _KERN_MMAN_H_
+
+/*
+ * Definitions for mmap(), munmap() and msync(), shared between the
+ * kernel and userland.
+ */
+
+/* Protection for mmap */
+#define PROT_NONE       0
+#define PROT_READ       1       /* Pages may be read */
+#define PROT_WRITE      2       /* Pages may be written */
+#define PROT_EXEC       4       /* Pages may be executed */
+
+/* Flags for mmap; one of MAP_SHARED and MAP_PRIVATE is required */
+#define MAP_SHARED      0x01    /* Changes go back to the file */
+#define MAP_PRIVATE     0x02    /* Changes are private to this process */
+#define MAP_FIXED       0x10    /* Map exactly at the address given */
+#define MAP_ANON        0x1000  /* Zero-filled memory; no file (private only) */
+
+/* What mmap returns on failure */
+#define MAP_FAILED      ((void *)-1)
+
+/* Flags for msync; the write is always done before msync returns */
+#define MS_ASYNC        0x01
+#define MS_SYNC         0x02
+#define MS_INVALIDATE   0x04
+
+#endif /* _KERN_MMAN_H_ */
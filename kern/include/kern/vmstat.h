@@ -0,0 +1,38 @@
+#ifndef _KERN_VMSTAT_H_
+#define _KERN_VMSTAT_H_
+
+/*
+ * VM statistics, as returned by vmstat(), shared between the kernel
+ * and userland.
+ *
+ * The event counts are totals over all CPUs since boot, and wrap;
+ * take differences between two calls to see what happened in between.
+ */
+
+/* Events counted in vs_counts */
+#define VMS_FAULTS          0   /* Faults vm_fault handled in full. */
+#define VMS_TLBMISSES       1   /* TLB misses, read or write. */
+#define VMS_TLBREFILLS      2   /* ...refilled straight from the page table. */
+#define VMS_TLBMODS         3   /* Writes to read-only translations. */
+#define VMS_TLBFLUSHES      4   /* Whole-TLB flushes. */
+#define VMS_ZEROFILLS       5   /* Pages given a zero-filled page. */
+#define VMS_ZEROMAPS        6   /* Pages mapped to the shared zero page. */
+#define VMS_COPIES          7   /* Copy-on-write copies. */
+#define VMS_FILEINS         8   /* Pages read in from files. */
+#define VMS_CACHEHITS       9   /* Text pages found in the page cache. */
+#define VMS_SWAPINS         10  /* Pages read in from swap. */
+#define VMS_SWAPOUTS        11  /* Pages written out to swap. */
+#define VMS_EVICTIONS       12  /* Pages taken away by pageout. */
+#define VMS_PAGEALLOCS      13  /* User pages allocated. */
+#define VMS_PAGEFREES       14  /* User pages freed. */
+#define VMS_NCOUNTS         15
+
+struct vmstat {
+        __u32 vs_counts[VMS_NCOUNTS];   /* Event counts, indexed by VMS_*. */
+        __u32 vs_npages;                /* Pages of RAM the VM system manages. */
+        __u32 vs_freepages;             /* ...free right now. */
+        __u32 vs_swappages;             /* Pages of swap. */
+        __u32 vs_swapused;              /* ...in use right now. */
+};
+
+#endif /* _KERN_VMSTAT_H_ */
@@ -0,0 +1,73 @@
+#ifndef _KMEM_CACHE_H_
+#define _KMEM_CACHE_H_
+
+#include <spinlock.h>
+
+/*
+ * Typed object caches.
+ *
+ * A cache hands out objects of a single size from page-sized slabs. The
+ * objects are packed at their exact size (rounded up to 8 bytes for
+ * alignment) instead of being rounded up to one of kmalloc's power-of-two
+ * block sizes.
+ *
+ * If a constructor is given, it is run once on every object when its slab
+ * is created. Objects must be handed back to kmem_cache_free() in their
+ * constructed state, so the constructor is not run again when the object
+ * is reused.
+ *
+ * Caches needed before anything could call kmem_cache_create() (threads,
+ * wait channels, synchronization primitives) can be declared statically
+ * with KMEM_CACHE_INITIALIZER. They show up in the statistics once they
+ * get their first slab.
+ */
+
+struct kmem_slab;
+
+struct kmem_cache {
+    const char *kc_name;            /* Name shown in the statistics. */
+    size_t kc_size;                 /* Requested object size. */
+    void (*kc_ctor)(void *obj);     /* Optional object constructor. */
+    struct spinlock kc_lock;        /* Protects everything below. */
+
+    size_t kc_objsize;              /* Object size as laid out in a slab. */
+    size_t kc_firstobj;             /* Offset of the first object in a slab. */
+    unsigned kc_perslab;            /* Objects per slab (0 until set up). */
+    struct kmem_slab *kc_slabs;     /* Slabs with at least one free object. */
+    bool kc_registered;             /* On the list of all caches? */
+    struct kmem_cache *kc_next;     /* Next on the list of all caches. */
+
+    /* Statistics */
+    unsigned kc_nslabs;             /* Slabs currently held. */
+    unsigned kc_nempty;             /* Held slabs with no objects in use. */
+    unsigned kc_inuse;              /* Objects currently allocated. */
+    unsigned long kc_allocs;        /* Total calls to kmem_cache_alloc. */
+    unsigned long kc_frees;         /* Total calls to kmem_cache_free. */
+    unsigned long kc_grows;         /* Slabs ever created. */
+    unsigned long kc_reaps;         /* Slabs ever given back. */
+};
+
+#define KMEM_CACHE_INITIALIZER(name, size, ctor) \
+    { .kc_name = (name), .kc_size = (size), .kc_ctor = (ctor), \
+      .kc_lock = SPINLOCK_INITIALIZER }
+
+/*
+ * Create a cache of objects of 'size' bytes. NAME should be a string
+ * constant; it is not copied. Returns NULL if out of memory.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size,
+                                     void (*ctor)(void *obj));
+
+/* Destroy a cache created with kmem_cache_create. It must be empty. */
+void kmem_cache_destroy(struct kmem_cache *kc);
+
+/* Allocate a (constructed) object. Returns NULL if out of memory. */
+void *kmem_cache_alloc(struct kmem_cache *kc);
+
+/* Return an object, in its constructed state, to its cache. */
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+
+/* Print per-cache statistics. */
+void kmem_cache_printstats(void);
+
+#endif /* _KMEM_CACHE_H_ */
@@ -124,7 +124,8 @@ uint32_t random(void);
  * If out of memory, kmalloc returns NULL.
  *
  * kheap_nextgeneration, dump, and dumpall do nothing unless heap
- * labeling (for leak detection) in kmalloc.c (q.v.) is enabled.
+ * labeling (for leak detection) in kmalloc.c (q.v.) is enabled;
+ * kheap_printprofile needs heap profiling enabled there too.
  */
 void *kmalloc(size_t size);
 void kfree(void *ptr);
@@ -134,6 +135,7 @@ unsigned long kheap_getused(void);
 void kheap_nextgeneration(void);
 void kheap_dump(void);
 void kheap_dumpall(void);
+void kheap_printprofile(void);
 
 /*
  * C string functions.
@@ -0,0 +1,59 @@
+#ifndef _PAGECACHE_H_
+#define _PAGECACHE_H_
+
+#include <vm.h>
+
+struct vnode;
+struct fs;
+
+/*
+ * Page cache for program text.
+ *
+ * Pages of a program's text and read-only data never change, so they
+ * are kept here by (vnode, offset) once read in, and every process
+ * running the program maps the same ones. The cache holds a coremap
+ * reference to each page, which makes the page shared and so keeps
+ * pageout away from it; pages nobody else maps are dropped instead
+ * when memory runs short.
+ *
+ * A cached page holds LEN bytes of the file from OFFSET, followed by
+ * zeros, so LEN is part of the key.
+ */
+
+/*
+ * Find a cached page. Returns it with a reference for the caller, or
+ * 0 if it isn't cached.
+ */
+paddr_t pagecache_lookup(struct vnode *vn, off_t offset, size_t len);
+
+/*
+ * Offer page PA, just read in, for the cache. Returns the page the
+ * caller should map, with the caller's reference: PA itself, or the
+ * one somebody else cached first, in which case the caller still has
+ * to free PA.
+ */
+paddr_t pagecache_insert(struct vnode *vn, off_t offset, size_t len,
+                         paddr_t pa);
+
+/*
+ * Free up to MAX cached pages that aren't mapped anywhere, oldest
+ * first. Returns the number freed.
+ */
+unsigned pagecache_reclaim(unsigned max);
+
+/*
+ * Forget VN's pages, because VN is about to change. Processes that
+ * have them mapped keep their copies. (A no-op under dumbvm.)
+ */
+void pagecache_purge(struct vnode *vn);
+
+/*
+ * Forget the pages of every file on FS, so the references the cache
+ * holds don't keep FS from being unmounted. (A no-op under dumbvm.)
+ */
+void pagecache_purgefs(struct fs *fs);
+
+/* Print the cache's counters. */
+void pagecache_printstats(void);
+
+#endif /* _PAGECACHE_H_ */
@@ -0,0 +1,59 @@
+#ifndef _PAGETABLE_H_
+#define _PAGETABLE_H_
+
+#include <vm.h>
+
+/*
+ * Two-level page table for a user address space.
+ *
+ * The top level has one pointer per 4M of user address space; each
+ * second-level table is one page of PTEs and is only allocated once
+ * something in its 4M is touched.
+ */
+
+typedef uint32_t pte_t;
+
+/* PTE bits */
+#define PTE_FRAME       PAGE_FRAME  /* Physical page, if present. */
+#define PTE_PRESENT     0x001       /* Page is in memory. */
+#define PTE_WRITE       0x002       /* Page may be written. */
+#define PTE_COW         0x004       /* Shared; copy before writing. */
+#define PTE_ZERO        0x008       /* Maps the shared zero page. */
+#define PTE_SWAPPED     0x010       /* In swap; the frame bits hold the slot. */
+#define PTE_DIRTY       0x020       /* Differs from the file it maps. */
+
+#define PTE_SLOT(pte)   ((pte) / PAGE_SIZE)
+#define PTE_MKSWAP(slot) ((pte_t)(slot) * PAGE_SIZE | PTE_SWAPPED)
+
+#define PT_NPTES        (PAGE_SIZE / sizeof(pte_t))
+#define PT_SPAN         (PT_NPTES * PAGE_SIZE)
+#define PT_NDIRS        (USERSPACETOP / PT_SPAN)
+
+#define PT_DIR(va)      ((va) / PT_SPAN)
+#define PT_INDEX(va)    (((va) / PAGE_SIZE) % PT_NPTES)
+
+struct pagetable {
+    pte_t *pt_dir[PT_NDIRS];        /* Second-level tables, or NULL. */
+};
+
+/* Create an empty page table. Returns NULL if out of memory. */
+struct pagetable *pt_create(void);
+
+/* Free a page table. Does not touch the pages the PTEs point to. */
+void pt_destroy(struct pagetable *pt);
+
+/*
+ * Return the PTE for VA. If its second-level table doesn't exist yet,
+ * create it if CREATE is set (returning NULL if out of memory) or
+ * otherwise return NULL.
+ */
+pte_t *pt_get(struct pagetable *pt, vaddr_t va, bool create);
+
+/*
+ * Call FN on every non-zero PTE for a page in [START, END), in address
+ * order. Stops and returns the first non-zero value FN returns.
+ */
+int pt_foreach(struct pagetable *pt, vaddr_t start, vaddr_t end,
+               int (*fn)(vaddr_t va, pte_t *pte, void *data), void *data);
+
+#endif /* _PAGETABLE_H_ */
@@ -4,5 +4,6 @@
 int sys_fork(struct trapframe *tf, pid_t *pid);
 int sys_getpid(pid_t *pid);
 int sys_waitpid(pid_t pid, int *status, int options, pid_t *ret_pid);
+int sys_sbrk(intptr_t amount, vaddr_t *oldbreak);
 
 #endif /* _PROC_SYSCALLS_H_ */
\ No newline at end of file
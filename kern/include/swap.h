@@ -0,0 +1,80 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include <vm.h>
+
+/*
+ * Swap space and page replacement.
+ *
+ * Swap is a raw disk divided into page-sized slots. Slot 0 is never
+ * handed out, so 0 can mean "no slot". Slots are reference counted
+ * because a swapped-out page is shared by parent and child after
+ * fork, just like a page in memory.
+ *
+ * The pageout thread keeps at least PAGEOUT_LOWATER pages free by
+ * evicting user pages chosen with a clock over the coremap. User page
+ * allocations leave the last PAGEOUT_RESERVE free pages to the kernel
+ * and reclaim pages themselves if the pageout thread falls behind.
+ */
+
+#define SWAP_DEVICE         "lhd1raw:"
+#define PAGEOUT_BATCH       8       /* Pages written per pageout pass. */
+#define PAGEOUT_RESERVE     8       /* Free pages kept for the kernel. */
+#define PAGEOUT_LOWATER     16      /* Wake the pageout thread below this. */
+#define PAGEOUT_HIWATER     32      /* Pageout thread stops at this. */
+
+/* Attach the swap device. Swap is optional. */
+void swap_bootstrap(void);
+
+/* Start the pageout thread. */
+void pageout_bootstrap(void);
+
+/* Whether there is any swap. */
+bool swap_enabled(void);
+
+/* Number of slots there are, and how many are in use. */
+unsigned swap_npages(void);
+unsigned swap_used(void);
+
+/* Allocate a slot with one reference. Returns 0 if swap is full. */
+unsigned swap_alloc(void);
+
+/* Add or drop a reference to a slot; the last swap_free frees it. */
+void swap_share(unsigned slot);
+void swap_free(unsigned slot);
+
+/* Current reference count of a slot. */
+unsigned swap_refcount(unsigned slot);
+
+/* Read a slot into the page at PA. */
+int swap_read(unsigned slot, paddr_t pa);
+
+/*
+ * Write the pages at PAS[0..N-1] to the consecutive slots starting at
+ * SLOT. Pages that compress well stay in memory in the compressed
+ * pool; the rest go to disk, consecutive ones in one request.
+ */
+int swap_write(unsigned slot, const paddr_t *pas, unsigned n);
+
+/*
+ * Free up to PAGEOUT_BATCH user pages right now, from the page cache
+ * if it has any to spare and otherwise by evicting them. Returns the
+ * number of pages freed. The caller must not hold any address space
+ * lock.
+ */
+unsigned pageout_reclaim(void);
+
+/* Poke the pageout thread if free memory is getting low. */
+void pageout_wakeup(void);
+
+/*
+ * Keep pageout away from every address space, e.g. while one is being
+ * torn down. Pageout holds this while it picks and evicts pages, so
+ * it never takes the lock of an address space that's gone.
+ * pageout_trylock doesn't wait, and fails if the lock is busy.
+ */
+void pageout_lock(void);
+bool pageout_trylock(void);
+void pageout_unlock(void);
+
+#endif /* _SWAP_H_ */
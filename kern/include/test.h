@@ -116,6 +116,10 @@ int kmallocstress(int, char **);
 int kmalloctest3(int, char **);
 int kmalloctest4(int, char **);
 int kmalloctest5(int, char **);
+int kmalloctest6(int, char **);
+int kmalloctest7(int, char **);
+int kmemcachetest(int, char **);
+int sbrktest(int, char **);
 int nettest(int, char **);
 
 /* Routine for running a user-level program. */
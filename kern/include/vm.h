@@ -39,6 +39,8 @@
 
 #include <machine/vm.h>
 
+struct vmstat;
+
 /* Fault-type arguments to vm_fault() */
 #define VM_FAULT_READ        0    /* A read was attempted */
 #define VM_FAULT_WRITE       1    /* A write was attempted */
@@ -62,8 +64,27 @@ void free_kpages(vaddr_t addr);
  */
 unsigned int coremap_used_bytes(void);
 
-/* TLB shootdown handling called from interprocessor_interrupt */
+/*
+ * TLB shootdown handling called from interprocessor_interrupt. A NULL
+ * argument means to invalidate the whole TLB.
+ */
 void vm_tlbshootdown(const struct tlbshootdown *);
 
+/* Print per-CPU TLB statistics (not available under dumbvm). */
+void vm_printtlbstats(void);
+
+/*
+ * Fill in VM statistics (see <kern/vmstat.h>). Returns ENOSYS under
+ * dumbvm, which doesn't keep any.
+ */
+int vm_getstats(struct vmstat *vs);
+
+/*
+ * Do a little VM housekeeping on an idle CPU, from thread_switch with
+ * interrupts off. Returns false if there was nothing to do, in which
+ * case the CPU can go to sleep.
+ */
+bool vm_idle(void);
+
 
 #endif /* _VM_H_ */
@@ -0,0 +1,10 @@
+#ifndef _VM_SYSCALLS_H_
+#define _VM_SYSCALLS_H_
+
+int sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+             off_t offset, vaddr_t *ret_addr);
+int sys_munmap(userptr_t addr, size_t len);
+int sys_msync(userptr_t addr, size_t len, int flags);
+int sys_vmstat(userptr_t buf);
+
+#endif /* _VM_SYSCALLS_H_ */
@@ -0,0 +1,59 @@
+#ifndef _VMPRIVATE_H_
+#define _VMPRIVATE_H_
+
+/*
+ * Interfaces shared between the parts of the VM system (vm.c,
+ * addrspace.c, coremap.c, pagetable.c). Not for use elsewhere.
+ */
+
+#include <pagetable.h>
+#include <kern/vmstat.h>
+
+struct region;
+
+/* Count a VM event (VMS_* from <kern/vmstat.h>) on this CPU. */
+void vm_count(unsigned event);
+
+/* Make AS (which may be NULL) the address space this CPU translates for. */
+void vm_tlbactivate(struct addrspace *as);
+
+/* Make sure no CPU thinks it's translating for AS, which is going away. */
+void vm_tlbforget(struct addrspace *as);
+
+/*
+ * Load a translation for VA described by PTE into this CPU's TLB, for
+ * the address space it's translating for.
+ */
+void vm_tlbload(vaddr_t va, pte_t pte);
+
+/*
+ * Invalidate the translation for VA in AS on every CPU, or all of AS's
+ * translations if VA is TLBSHOOTDOWN_ALL. Make the PTE change first.
+ * Returns once no CPU can use the old translation any more. Only CPUs
+ * running AS are interrupted.
+ *
+ * To invalidate several pages, possibly in several address spaces,
+ * with one interrupt per CPU, call vm_shootdown_add for each between
+ * vm_shootdown_begin and vm_shootdown_end. The old translations may
+ * still be in use until vm_shootdown_end returns. Don't hold any
+ * spinlocks across vm_shootdown_end.
+ */
+struct vm_shootdownbatch {
+    uint32_t sb_cpus;               /* CPUs with shootdowns queued. */
+};
+
+void vm_shootdown(struct addrspace *as, vaddr_t va);
+void vm_shootdown_begin(struct vm_shootdownbatch *sb);
+void vm_shootdown_add(struct vm_shootdownbatch *sb, struct addrspace *as,
+                      vaddr_t va);
+void vm_shootdown_end(struct vm_shootdownbatch *sb);
+
+/*
+ * Bring the page at VA in shared mapping RG into page *SPARE if it's
+ * in swap, untouched, or the zero page; otherwise leave *SPARE. It
+ * comes in read-only, keeping PTE_DIRTY. Call with as_lock held.
+ */
+int vm_sharedin(struct addrspace *as, struct region *rg, vaddr_t va,
+                pte_t *pte, paddr_t *spare);
+
+#endif /* _VMPRIVATE_H_ */
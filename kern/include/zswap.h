@@ -0,0 +1,51 @@
+#ifndef _ZSWAP_H_
+#define _ZSWAP_H_
+
+#include <vm.h>
+
+/*
+ * Compressed swap cache.
+ *
+ * Pages going out to swap are compressed and kept in kernel memory,
+ * indexed by the swap slot they were given, and only reach the disk
+ * once the pool is full and they're the oldest there. Pages that
+ * don't compress to half a page or less go straight to disk. The
+ * pool holds at most 1/ZSWAP_FRACTION of physical memory.
+ *
+ * Only swap.c calls these, and never while holding a spinlock.
+ */
+
+#define ZSWAP_FRACTION      8
+
+/* Set up the pool for a swap device with NSLOTS slots. */
+void zswap_bootstrap(unsigned nslots);
+
+/*
+ * Compress the page at PA and keep it for SLOT. Returns 0 on success,
+ * EFBIG if the page doesn't compress well enough, ENOSPC if the pool
+ * is full, or ENOMEM.
+ */
+int zswap_store(unsigned slot, paddr_t pa);
+
+/*
+ * Decompress SLOT's page into PA, if the pool has it. The pool keeps
+ * its copy, since the slot still holds the page.
+ */
+bool zswap_load(unsigned slot, paddr_t pa);
+
+/* Forget SLOT's page, because the slot is being freed. */
+void zswap_drop(unsigned slot);
+
+/*
+ * Make room: decompress the oldest page in the pool into PA and
+ * return its slot in *SLOT. The pool keeps serving the page until the
+ * caller has written it to disk and called zswap_forget. Returns
+ * false if the pool is empty.
+ */
+bool zswap_evict(paddr_t pa, unsigned *slot);
+void zswap_forget(unsigned slot);
+
+/* Print the pool's size, compression ratio and counters. */
+void zswap_printstats(void);
+
+#endif /* _ZSWAP_H_ */
@@ -43,8 +43,15 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <kmem_cache.h>
+#include <vm.h>
+#include <pagecache.h>
+#include <zswap.h>
+#include <coremap.h>
+#include <kern/vmstat.h>
 #include <prompt.h>
 #include "opt-sfs.h"
+#include "opt-dumbvm.h"
 #include "opt-net.h"
 #include "opt-synchprobs.h"
 #include "opt-automationtest.h"
@@ -471,6 +478,10 @@ cmd_kheapstats(int nargs, char **args)
 	(void)args;
 
 	kheap_printstats();
+#if !OPT_DUMBVM
+	coremap_printzpoolstats();
+	coremap_printcompactstats();
+#endif
 
 	return 0;
 }
@@ -499,6 +510,137 @@ cmd_kheapgeneration(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_kheapprofile(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kheap_printprofile();
+
+	return 0;
+}
+
+static
+int
+cmd_kcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	kmem_cache_printstats();
+
+	return 0;
+}
+
+#if !OPT_DUMBVM
+static
+int
+cmd_tlbstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	vm_printtlbstats();
+
+	return 0;
+}
+
+static
+int
+cmd_pagecachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	pagecache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_zswapstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	zswap_printstats();
+
+	return 0;
+}
+#endif
+
+/*
+ * Command for VM statistics: one line of totals since boot, then,
+ * given an interval, a line of what changed in each interval, for
+ * COUNT lines in all (10 by default; the menu can't be interrupted).
+ */
+static
+void
+vmstat_print(const struct vmstat *vs, const struct vmstat *prev)
+{
+	uint32_t d[VMS_NCOUNTS];
+
+	for (unsigned i = 0; i < VMS_NCOUNTS; ++i) {
+		d[i] = vs->vs_counts[i] - (prev == NULL ? 0 :
+					   prev->vs_counts[i]);
+	}
+	kprintf("%7u %6u %6u %5u %6u %6u %6u %6u %6u %6u %7u %7u\n",
+		d[VMS_FAULTS], d[VMS_TLBREFILLS], d[VMS_ZEROFILLS],
+		d[VMS_COPIES], d[VMS_FILEINS], d[VMS_SWAPINS],
+		d[VMS_SWAPOUTS], d[VMS_EVICTIONS], d[VMS_PAGEALLOCS],
+		d[VMS_PAGEFREES], vs->vs_freepages, vs->vs_swapused);
+}
+
+static
+int
+cmd_vmstat(int nargs, char **args)
+{
+	struct vmstat vs, prev;
+	int interval, count, result;
+
+	interval = 0;
+	count = 10;
+	if (nargs > 3) {
+		kprintf("Usage: vmstat [seconds [count]]\n");
+		return EINVAL;
+	}
+	if (nargs > 1) {
+		interval = atoi(args[1]);
+		if (interval <= 0) {
+			kprintf("vmstat: bad interval %s\n", args[1]);
+			return EINVAL;
+		}
+	}
+	if (nargs > 2) {
+		count = atoi(args[2]);
+		if (count <= 0) {
+			kprintf("vmstat: bad count %s\n", args[2]);
+			return EINVAL;
+		}
+	}
+
+	result = vm_getstats(&vs);
+	if (result) {
+		kprintf("vmstat: %s\n", strerror(result));
+		return result;
+	}
+	kprintf(" faults refill  zfill   cow filein  swpin swpout  evict "
+		" alloc   free freepgs swpused\n");
+	vmstat_print(&vs, NULL);
+
+	while (interval > 0 && --count > 0) {
+		clocksleep(interval);
+		prev = vs;
+		vm_getstats(&vs);
+		vmstat_print(&vs, &prev);
+	}
+
+	return 0;
+}
+
 static
 int
 cmd_kheapdump(int nargs, char **args)
@@ -583,6 +725,12 @@ static const char *testmenu[] = {
 	"[km3] Large kmalloc test            ",
 	"[km4] Multipage kmalloc test        ",
 	"[km5] kmalloc coremap alloc test    ",
+	"[km6] kfree scaling benchmark       ",
+	"[km7] Large kernel heap test        ",
+	"[kc1] Object cache test             ",
+#if !OPT_DUMBVM
+	"[vm1] sbrk heap test                ",
+#endif
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
@@ -667,6 +815,14 @@ static const char *mainmenu[] = {
 	"[khu] Kernel heap usage             ",
 	"[khgen] Next kernel heap generation ",
 	"[khdump] Dump kernel heap           ",
+	"[khprof] Kernel heap profile        ",
+	"[kc] Kernel object cache stats      ",
+	"[vmstat] VM statistics              ",
+#if !OPT_DUMBVM
+	"[tlb] TLB statistics                ",
+	"[pc] Page cache statistics          ",
+	"[zs] Compressed swap statistics     ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -722,6 +878,14 @@ static struct {
 	{ "khu",        cmd_kheapused },
 	{ "khgen",      cmd_kheapgeneration },
 	{ "khdump",     cmd_kheapdump },
+	{ "khprof",     cmd_kheapprofile },
+	{ "kc",         cmd_kcachestats },
+	{ "vmstat",     cmd_vmstat },
+#if !OPT_DUMBVM
+	{ "tlb",        cmd_tlbstats },
+	{ "pc",         cmd_pagecachestats },
+	{ "zs",         cmd_zswapstats },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -733,6 +897,12 @@ static struct {
 	{ "km3",	kmalloctest3 },
 	{ "km4",	kmalloctest4 },
 	{ "km5",	kmalloctest5 },
+	{ "km6",	kmalloctest6 },
+	{ "km7",	kmalloctest7 },
+	{ "kc1",	kmemcachetest },
+#if !OPT_DUMBVM
+	{ "vm1",	sbrktest },
+#endif
 #if OPT_NET
 	{ "net",	nettest },
 #endif
@@ -1,4 +1,6 @@
 #include <types.h>
+#include <lib.h>
+#include <vm.h>
 #include <file_handle.h>
 #include <synch.h>
 #include <vfs.h>
@@ -9,6 +11,13 @@
 #include <kern/fcntl.h>
 #include <kern/stat.h>
 #include <kern/seek.h>
+#include <kmem_cache.h>
+#include <pagecache.h>
+#include <proc.h>
+
+/* Object cache for file handles. */
+static struct kmem_cache fh_cache =
+    KMEM_CACHE_INITIALIZER("file_handle", sizeof(struct file_handle), NULL);
 
 /*
  * Creates a new file handle to the file 'path' and returns the corresponding
@@ -35,32 +44,32 @@ fh_create(struct file_handle **fh, char *path, int flags)
         return EINVAL;
     }
 
-    new_fh = kmalloc(sizeof(struct file_handle));
+    new_fh = kmem_cache_alloc(&fh_cache);
     if (new_fh == NULL) {
         return ENOMEM;
     }
 
-    new_fh->fh_file_obj = kmalloc(sizeof(struct vnode));
-    if (new_fh->fh_file_obj == NULL) {
-        kfree(new_fh);
-        return ENOMEM;
-    }
-
+    /* vfs_open hands back the vnode; no need to allocate one here. */
+    new_fh->fh_file_obj = NULL;
     result = vfs_open(path, flags, 0664, &(new_fh->fh_file_obj));
     if (result) {
-        kfree(new_fh->fh_file_obj);
-        kfree(new_fh);
+        kmem_cache_free(&fh_cache, new_fh);
         return result;
     }
 
+    /* Running copies of a program mustn't pick up half-written text. */
+    if ((flags & O_ACCMODE) != O_RDONLY || (flags & O_TRUNC)) {
+        pagecache_purge(new_fh->fh_file_obj);
+    }
+
     /* Set offset according to flags */
     if (flags & O_APPEND) {
         struct stat *file_info = kmalloc(sizeof(struct stat));
 
         result = VOP_STAT(new_fh->fh_file_obj, file_info);
         if (result) {
-            kfree(new_fh->fh_file_obj);
-            kfree(new_fh);
+            vfs_close(new_fh->fh_file_obj);
+            kmem_cache_free(&fh_cache, new_fh);
             kfree(file_info);
             return result;
         }
@@ -95,88 +104,353 @@ fh_destroy(struct file_handle *fh)
     if (fh->fh_refcount == 0) {
         vfs_close(fh->fh_file_obj);
         lock_destroy(fh->fh_lock);
-        kfree(fh);
+        kmem_cache_free(&fh_cache, fh);
+    }
+}
+
+/*
+ * Does the I/O described by 'uio' at the file's current offset, and
+ * moves the offset past it. The actual number of bytes transferred are
+ * stored in 'size'.
+ *
+ * The caller has checked the file's mode. Returns 0 on success, error
+ * value otherwise.
+ */
+static
+int
+fh_io(struct file_handle *fh, struct uio *uio, int *size)
+{
+    int result;
+
+    KASSERT(size != NULL);
+
+    lock_acquire(fh->fh_lock);
+
+    uio->uio_offset = fh->fh_offset;
+    if (uio->uio_rw == UIO_WRITE) {
+        result = VOP_WRITE(fh->fh_file_obj, uio);
+    }
+    else {
+        result = VOP_READ(fh->fh_file_obj, uio);
+    }
+    if (result) {
+        lock_release(fh->fh_lock);
+        return result;
     }
+
+    /* Determine the number of bytes transferred */
+    *size = uio->uio_offset - fh->fh_offset;
+
+    /* Update the file offset information */
+    fh->fh_offset = uio->uio_offset;
+
+    lock_release(fh->fh_lock);
+
+    return 0;
 }
 
 /*
- * Writes the buffer pointed to by 'buf', of size buflen, to the file 'fh'.
+ * Writes the user buffer pointed to by 'buf', of size buflen, to the file
+ * 'fh'. The data is copied straight from user space by the file system.
  * The actual number of bytes written are stored in 'size'.
  * 
  * Returns 0 on success, error value otherwise.
  */
 int
-fh_write(struct file_handle *fh, void *buf, size_t buflen, int *size)
+fh_write(struct file_handle *fh, userptr_t buf, size_t buflen, int *size)
 {
-    KASSERT(buf != NULL);
-    KASSERT(size != NULL);
+    struct iovec iov;
+    struct uio uio;
 
     /* Make sure we have the permission to write */
     if (fh->fh_flags == O_RDONLY) {
         return EPERM;
     }
 
-    lock_acquire(fh->fh_lock);
+    uio_uinit(&iov, &uio, buf, buflen, 0, UIO_WRITE);
+    return fh_io(fh, &uio, size);
+}
 
+/*
+ * Reads 'buflen' number of bytes into the user buffer 'buf' from the file
+ * 'fh', with no copy through a kernel buffer. The actual number of bytes
+ * read are stored in 'size'.
+ * 
+ * Returns 0 on success, error value otherwise.
+ */
+int
+fh_read(struct file_handle *fh, userptr_t buf, size_t buflen, int *size)
+{
     struct iovec iov;
     struct uio uio;
- 
-    uio_kinit(&iov, &uio, buf, buflen, fh->fh_offset, UIO_WRITE);
-    int result = VOP_WRITE(fh->fh_file_obj, &uio);
+
+    /* Make sure the file is not write-only */
+    if (fh->fh_flags == O_WRONLY) {
+        return EPERM;
+    }
+
+    uio_uinit(&iov, &uio, buf, buflen, 0, UIO_READ);
+    return fh_io(fh, &uio, size);
+}
+
+/*
+ * Writes the 'iovcnt' user buffers described by 'iov', 'len' bytes in
+ * all, to the file 'fh' as one write, or reads up to 'len' bytes into
+ * them, filling each before moving on to the next. 'iov' is used up
+ * as the data is copied. The actual number of bytes transferred are
+ * stored in 'size'.
+ *
+ * Returns 0 on success, error value otherwise.
+ */
+static
+int
+fh_iov(struct file_handle *fh, struct iovec *iov, unsigned iovcnt,
+       size_t len, enum uio_rw rw, int *size)
+{
+    struct uio uio;
+
+    uio.uio_iov = iov;
+    uio.uio_iovcnt = iovcnt;
+    uio.uio_offset = 0;
+    uio.uio_resid = len;
+    uio.uio_segflg = UIO_USERSPACE;
+    uio.uio_rw = rw;
+    uio.uio_space = proc_getas();
+
+    return fh_io(fh, &uio, size);
+}
+
+int
+fh_writev(struct file_handle *fh, struct iovec *iov, unsigned iovcnt,
+          size_t len, int *size)
+{
+    if (fh->fh_flags == O_RDONLY) {
+        return EPERM;
+    }
+    return fh_iov(fh, iov, iovcnt, len, UIO_WRITE, size);
+}
+
+int
+fh_readv(struct file_handle *fh, struct iovec *iov, unsigned iovcnt,
+         size_t len, int *size)
+{
+    if (fh->fh_flags == O_WRONLY) {
+        return EPERM;
+    }
+    return fh_iov(fh, iov, iovcnt, len, UIO_READ, size);
+}
+
+/*
+ * Does the I/O described by 'uio' at the offset it already has, leaving
+ * the file's offset alone. That needs no fh_lock, so processes sharing
+ * the handle don't wait for each other here.
+ */
+static
+int
+fh_pio(struct file_handle *fh, struct uio *uio, int *size)
+{
+    off_t pos = uio->uio_offset;
+    int result;
+
+    KASSERT(size != NULL);
+
+    if (!VOP_ISSEEKABLE(fh->fh_file_obj)) {
+        return ESPIPE;
+    }
+    if (pos < 0) {
+        return EINVAL;
+    }
+
+    if (uio->uio_rw == UIO_WRITE) {
+        result = VOP_WRITE(fh->fh_file_obj, uio);
+    }
+    else {
+        result = VOP_READ(fh->fh_file_obj, uio);
+    }
     if (result) {
-        lock_release(fh->fh_lock);
         return result;
     }
 
-    /* Determine the number of bytes written */
-    *size = uio.uio_offset - fh->fh_offset;
+    *size = uio->uio_offset - pos;
+    return 0;
+}
 
-    /* Update the file offset information */
-    fh->fh_offset = uio.uio_offset;
+/*
+ * Writes the user buffer 'buf', of size buflen, to the file 'fh' at
+ * offset 'pos', without using or changing the file's offset. The actual
+ * number of bytes written are stored in 'size'.
+ *
+ * Returns 0 on success, error value otherwise.
+ */
+int
+fh_pwrite(struct file_handle *fh, userptr_t buf, size_t buflen, off_t pos,
+          int *size)
+{
+    struct iovec iov;
+    struct uio uio;
 
-    lock_release(fh->fh_lock);
+    if (fh->fh_flags == O_RDONLY) {
+        return EPERM;
+    }
 
-    return 0;
+    uio_uinit(&iov, &uio, buf, buflen, pos, UIO_WRITE);
+    return fh_pio(fh, &uio, size);
 }
 
 /*
- * Reads 'buflen' number of bytes into the buffer 'buf' from the file 'fh'.
- * The actual number of bytes read are stored in 'size'.
- * 
+ * Reads up to 'buflen' bytes from offset 'pos' in the file 'fh' into the
+ * user buffer 'buf', without using or changing the file's offset. The
+ * actual number of bytes read are stored in 'size'.
+ *
  * Returns 0 on success, error value otherwise.
  */
 int
-fh_read(struct file_handle *fh, void *buf, size_t buflen, int *size)
+fh_pread(struct file_handle *fh, userptr_t buf, size_t buflen, off_t pos,
+         int *size)
 {
-    KASSERT(buf != NULL);
-    KASSERT(size != NULL);
+    struct iovec iov;
+    struct uio uio;
 
-    /* Make sure the file is not write-only */
     if (fh->fh_flags == O_WRONLY) {
         return EPERM;
     }
 
-    lock_acquire(fh->fh_lock);
+    uio_uinit(&iov, &uio, buf, buflen, pos, UIO_READ);
+    return fh_pio(fh, &uio, size);
+}
 
+/*
+ * Copies up to 'len' bytes from the file 'in' to the file 'out', through
+ * a kernel buffer, without the data ever passing through user space.
+ * 'inpos' and 'outpos' give the offsets to read and write at, and are
+ * advanced past the bytes copied; if either is NULL, that file's own
+ * offset is used and advanced instead, under its fh_lock. Copying stops
+ * at end of file or on a short write. The actual number of bytes copied
+ * are stored in 'size'.
+ *
+ * Returns 0 on success, error value otherwise. An error after some data
+ * was copied is not reported, so the caller sees a short copy.
+ */
+int
+fh_copy(struct file_handle *in, off_t *inpos, struct file_handle *out,
+        off_t *outpos, size_t len, int *size)
+{
+    struct file_handle *first, *second;
     struct iovec iov;
     struct uio uio;
- 
-    uio_kinit(&iov, &uio, buf, buflen, fh->fh_offset, UIO_READ);
-    int result = VOP_READ(fh->fh_file_obj, &uio);
-    if (result) {
-        lock_release(fh->fh_lock);
-        return result;
+    off_t rpos, wpos;
+    size_t bufsize, chunk, got, put, total;
+    void *buf;
+    int result;
+
+    KASSERT(size != NULL);
+
+    if (in->fh_flags == O_WRONLY || out->fh_flags == O_RDONLY) {
+        return EPERM;
+    }
+    if ((inpos != NULL && !VOP_ISSEEKABLE(in->fh_file_obj)) ||
+        (outpos != NULL && !VOP_ISSEEKABLE(out->fh_file_obj))) {
+        return ESPIPE;
+    }
+
+    /* The count has to fit in the (signed) return value. */
+    if (len > ((size_t)-1 >> 1)) {
+        len = (size_t)-1 >> 1;
     }
 
-    /* Determine the number of bytes read */
-    *size = uio.uio_offset - fh->fh_offset;
+    /* Big chunks if we can get them, but a page will do. */
+    bufsize = FH_COPYCHUNK;
+    buf = kmalloc(bufsize);
+    if (buf == NULL) {
+        bufsize = PAGE_SIZE;
+        buf = kmalloc(bufsize);
+        if (buf == NULL) {
+            return ENOMEM;
+        }
+    }
 
-    /* Update the file offset information */
-    fh->fh_offset = uio.uio_offset;
+    /* Lock the handles whose offsets we use, in address order. */
+    first = inpos == NULL ? in : NULL;
+    second = outpos == NULL ? out : NULL;
+    if (first == second) {
+        second = NULL;
+    }
+    else if (first != NULL && second != NULL && second < first) {
+        first = out;
+        second = in;
+    }
+    if (first != NULL) {
+        lock_acquire(first->fh_lock);
+    }
+    if (second != NULL) {
+        lock_acquire(second->fh_lock);
+    }
 
-    lock_release(fh->fh_lock);
+    rpos = inpos != NULL ? *inpos : in->fh_offset;
+    wpos = outpos != NULL ? *outpos : out->fh_offset;
 
-    return 0;
+    result = 0;
+    if (rpos < 0 || wpos < 0) {
+        result = EINVAL;
+    }
+    /* Copying a file onto an overlapping part of itself isn't allowed. */
+    else if (in->fh_file_obj == out->fh_file_obj &&
+             rpos < wpos + (off_t)len && wpos < rpos + (off_t)len) {
+        result = EINVAL;
+    }
+
+    total = 0;
+    while (result == 0 && total < len) {
+        chunk = len - total < bufsize ? len - total : bufsize;
+
+        uio_kinit(&iov, &uio, buf, chunk, rpos, UIO_READ);
+        result = VOP_READ(in->fh_file_obj, &uio);
+        got = uio.uio_offset - rpos;
+        if (result || got == 0) {
+            break;
+        }
+
+        uio_kinit(&iov, &uio, buf, got, wpos, UIO_WRITE);
+        result = VOP_WRITE(out->fh_file_obj, &uio);
+        put = uio.uio_offset - wpos;
+
+        /* Only what made it to the output counts as copied. */
+        rpos += put;
+        wpos += put;
+        total += put;
+        if (put < got) {
+            break;
+        }
+    }
+    if (total > 0) {
+        result = 0;
+    }
+
+    if (result == 0) {
+        if (inpos != NULL) {
+            *inpos = rpos;
+        }
+        else {
+            in->fh_offset = rpos;
+        }
+        if (outpos != NULL) {
+            *outpos = wpos;
+        }
+        else {
+            out->fh_offset = wpos;
+        }
+        *size = total;
+    }
+
+    if (second != NULL) {
+        lock_release(second->fh_lock);
+    }
+    if (first != NULL) {
+        lock_release(first->fh_lock);
+    }
+    kfree(buf);
+
+    return result;
 }
 
 /*
@@ -53,12 +53,17 @@
 #include <file_handle.h>
 #include <thread.h>
 #include <proc_table.h>
+#include <kmem_cache.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
  */
 struct proc *kproc;
 
+/* Object cache for proc structures. */
+static struct kmem_cache proc_cache =
+    KMEM_CACHE_INITIALIZER("proc", sizeof(struct proc), NULL);
+
 /*
  * Create a proc structure.
  */
@@ -69,13 +74,13 @@ proc_create(const char *name)
     struct proc *proc;
     int result;
 
-    proc = kmalloc(sizeof(*proc));
+    proc = kmem_cache_alloc(&proc_cache);
     if (proc == NULL) {
         return NULL;
     }
     proc->p_name = kstrdup(name);
     if (proc->p_name == NULL) {
-        kfree(proc);
+        kmem_cache_free(&proc_cache, proc);
         return NULL;
     }
 
@@ -106,7 +111,7 @@ proc_create(const char *name)
             kfree(stdout_str);
             kfree(stderr_str);
             kfree(proc->p_name);
-            kfree(proc);
+            kmem_cache_free(&proc_cache, proc);
             return NULL;
         }
 
@@ -117,7 +122,7 @@ proc_create(const char *name)
             kfree(stdout_str);
             kfree(stderr_str);
             kfree(proc->p_name);
-            kfree(proc);
+            kmem_cache_free(&proc_cache, proc);
             fh_destroy(fh_stdin);
             return NULL;
         }
@@ -129,7 +134,7 @@ proc_create(const char *name)
             kfree(stdout_str);
             kfree(stderr_str);
             kfree(proc->p_name);
-            kfree(proc);
+            kmem_cache_free(&proc_cache, proc);
             fh_destroy(fh_stdin);
             fh_destroy(fh_stdout);
             return NULL;
@@ -142,7 +147,7 @@ proc_create(const char *name)
             kfree(stdout_str);
             kfree(stderr_str);
             kfree(proc->p_name);
-            kfree(proc);
+            kmem_cache_free(&proc_cache, proc);
             fh_destroy(fh_stdin);
             fh_destroy(fh_stdout);
             fh_destroy(fh_stderr);
@@ -173,7 +178,7 @@ proc_create(const char *name)
             fh_destroy(proc->p_ft[2]);
             kfree(proc->p_ft);
             kfree(proc->p_name);
-            kfree(proc);
+            kmem_cache_free(&proc_cache, proc);
             return NULL;
         }
     }
@@ -283,7 +288,7 @@ proc_destroy(struct proc *proc)
     spinlock_cleanup(&proc->p_lock);
 
     kfree(proc->p_name);
-    kfree(proc);
+    kmem_cache_free(&proc_cache, proc);
 }
 
 /*
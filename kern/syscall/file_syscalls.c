@@ -2,6 +2,7 @@
 #include <limits.h>
 #include <kern/errno.h>
 #include <kern/fcntl.h>
+#include <kern/iovec.h>
 #include <kern/seek.h>
 #include <vm.h>
 #include <vfs.h>
@@ -68,35 +69,153 @@ sys_write(int fd, userptr_t user_buf_ptr, size_t buflen, int *size)
         }
     }
 
+    /* The file system copies straight from the user buffer. */
+    return fh_write(curproc->p_ft[fd], user_buf_ptr, buflen, size);
+}
+
+/*
+ * If the read is successful, 0 is returned and the number of bytes read
+ * are reflected in 'size'.
+ * Otherwise, an error code is returned and 'size' and 'buffer' are
+ * unchanged.
+ */
+int
+sys_read(int fd, userptr_t user_buf_ptr, size_t buflen, int *size)
+{
+    /* Make sure the fd is valid */
+    if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0)) {
+        return EBADF;
+    }
+    else {
+        if (curproc->p_ft[fd] == NULL) {
+            return EBADF;
+        }
+    }
+
+    /* The file system copies straight into the user buffer. */
+    return fh_read(curproc->p_ft[fd], user_buf_ptr, buflen, size);
+}
+
+/*
+ * Writes the user buffer to the file at offset 'pos', leaving the file's
+ * offset as it was. If the write is successful, 0 is returned and the
+ * number of bytes written are reflected in 'size'. Otherwise, an error
+ * code is returned and 'size' is unchanged.
+ */
+int
+sys_pwrite(int fd, userptr_t user_buf_ptr, size_t buflen, off_t pos,
+           int *size)
+{
+    /* Make sure the fd is valid */
+    if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0)) {
+        return EBADF;
+    }
+    else {
+        if (curproc->p_ft[fd] == NULL) {
+            return EBADF;
+        }
+    }
+
+    return fh_pwrite(curproc->p_ft[fd], user_buf_ptr, buflen, pos, size);
+}
+
+/*
+ * Reads from the file at offset 'pos' into the user buffer, leaving the
+ * file's offset as it was. If the read is successful, 0 is returned and
+ * the number of bytes read are reflected in 'size'. Otherwise, an error
+ * code is returned and 'size' is unchanged.
+ */
+int
+sys_pread(int fd, userptr_t user_buf_ptr, size_t buflen, off_t pos,
+          int *size)
+{
+    /* Make sure the fd is valid */
+    if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0)) {
+        return EBADF;
+    }
+    else {
+        if (curproc->p_ft[fd] == NULL) {
+            return EBADF;
+        }
+    }
+
+    return fh_pread(curproc->p_ft[fd], user_buf_ptr, buflen, pos, size);
+}
+
+/* Number of iovecs readv and writev handle without a kmalloc. */
+#define FAST_IOVCNT 8
+
+/*
+ * Copies in the user's array of 'iovcnt' iovecs and checks it. Arrays of
+ * up to FAST_IOVCNT go in 'fast'; bigger ones are kmalloc'd, and the
+ * caller frees '*iov' if it isn't 'fast'. The total length of the
+ * buffers is stored in 'len'.
+ *
+ * Returns 0 on success, error code otherwise.
+ */
+static
+int
+iov_copyin(userptr_t user_iov_ptr, int iovcnt, struct iovec *fast,
+           struct iovec **iov, size_t *len)
+{
+    struct iovec *kiov;
+    size_t total;
     int result;
 
-    /* Copy the buffer to be written into kernel space */
-    void *buf = kmalloc(buflen);
-    result = copyin(user_buf_ptr, buf, buflen);
-    if (result) {
-        kfree(buf);
-        return result;
+    if (iovcnt <= 0 || iovcnt > IOV_MAX) {
+        return EINVAL;
+    }
+
+    if (iovcnt <= FAST_IOVCNT) {
+        kiov = fast;
+    }
+    else {
+        kiov = kmalloc(iovcnt * sizeof(struct iovec));
+        if (kiov == NULL) {
+            return ENOMEM;
+        }
     }
 
-    result = fh_write(curproc->p_ft[fd], buf, buflen, size);
+    /* The user's iovecs have the same layout as the kernel's. */
+    result = copyin(user_iov_ptr, kiov, iovcnt * sizeof(struct iovec));
     if (result) {
-        kfree(buf);
-        return result;
+        goto fail;
     }
 
-    kfree(buf);
+    /* The total has to fit in the (signed) return value. */
+    total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        if (kiov[i].iov_len > ((size_t)-1 >> 1) - total) {
+            result = EINVAL;
+            goto fail;
+        }
+        total += kiov[i].iov_len;
+    }
+
+    *iov = kiov;
+    *len = total;
     return 0;
+
+fail:
+    if (kiov != fast) {
+        kfree(kiov);
+    }
+    return result;
 }
 
 /*
- * If the read is successful, 0 is returned and the number of bytes read
- * are reflected in 'size'.
- * Otherwise, an error code is returned and 'size' and 'buffer' are
- * unchanged.
+ * Writes the 'iovcnt' buffers described by the user's iovec array to the
+ * file, in order, as one write. If the write is successful, 0 is returned
+ * and the number of bytes written are reflected in 'size'. Otherwise, an
+ * error code is returned and 'size' is unchanged.
  */
 int
-sys_read(int fd, userptr_t user_buf_ptr, size_t buflen, int *size)
+sys_writev(int fd, userptr_t user_iov_ptr, int iovcnt, int *size)
 {
+    struct iovec fast[FAST_IOVCNT], *iov;
+    size_t len;
+    int result;
+
     /* Make sure the fd is valid */
     if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0)) {
         return EBADF;
@@ -107,23 +226,116 @@ sys_read(int fd, userptr_t user_buf_ptr, size_t buflen, int *size)
         }
     }
 
+    result = iov_copyin(user_iov_ptr, iovcnt, fast, &iov, &len);
+    if (result) {
+        return result;
+    }
+
+    result = fh_writev(curproc->p_ft[fd], iov, iovcnt, len, size);
+
+    if (iov != fast) {
+        kfree(iov);
+    }
+    return result;
+}
+
+/*
+ * Reads from the file into the buffers described by the user's iovec
+ * array, filling each in turn. If the read is successful, 0 is returned
+ * and the number of bytes read are reflected in 'size'. Otherwise, an
+ * error code is returned and 'size' is unchanged.
+ */
+int
+sys_readv(int fd, userptr_t user_iov_ptr, int iovcnt, int *size)
+{
+    struct iovec fast[FAST_IOVCNT], *iov;
+    size_t len;
     int result;
 
-    void *buf = kmalloc(buflen);
-    result = fh_read(curproc->p_ft[fd], buf, buflen, size);
+    /* Make sure the fd is valid */
+    if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0)) {
+        return EBADF;
+    }
+    else {
+        if (curproc->p_ft[fd] == NULL) {
+            return EBADF;
+        }
+    }
+
+    result = iov_copyin(user_iov_ptr, iovcnt, fast, &iov, &len);
     if (result) {
-        kfree(buf);
         return result;
     }
 
-    /* Copy the read buffer to user space */
-    result = copyout(buf, user_buf_ptr, buflen);
+    result = fh_readv(curproc->p_ft[fd], iov, iovcnt, len, size);
+
+    if (iov != fast) {
+        kfree(iov);
+    }
+    return result;
+}
+
+/*
+ * Copies up to 'len' bytes from file 'infd' to file 'outfd' without the
+ * data passing through user space. 'user_inpos_ptr' and 'user_outpos_ptr'
+ * point to the offsets to use, which are updated, or are NULL to use and
+ * update the files' own offsets. No flags are defined yet.
+ *
+ * If the copy is successful, 0 is returned and the number of bytes copied
+ * (0 at end of file) are reflected in 'size'. Otherwise, an error code
+ * is returned and 'size' is unchanged.
+ */
+int
+sys_copy_file_range(int infd, userptr_t user_inpos_ptr, int outfd,
+                    userptr_t user_outpos_ptr, size_t len, unsigned flags,
+                    int *size)
+{
+    off_t inpos, outpos;
+    int result;
+
+    /* Make sure both fds are valid */
+    if (((unsigned)infd >= curproc->p_ft_size) || (infd < 0) ||
+        curproc->p_ft[infd] == NULL) {
+        return EBADF;
+    }
+    if (((unsigned)outfd >= curproc->p_ft_size) || (outfd < 0) ||
+        curproc->p_ft[outfd] == NULL) {
+        return EBADF;
+    }
+
+    if (flags != 0) {
+        return EINVAL;
+    }
+
+    if (user_inpos_ptr != NULL) {
+        result = copyin(user_inpos_ptr, &inpos, sizeof(inpos));
+        if (result) {
+            return result;
+        }
+    }
+    if (user_outpos_ptr != NULL) {
+        result = copyin(user_outpos_ptr, &outpos, sizeof(outpos));
+        if (result) {
+            return result;
+        }
+    }
+
+    result = fh_copy(curproc->p_ft[infd],
+                     user_inpos_ptr != NULL ? &inpos : NULL,
+                     curproc->p_ft[outfd],
+                     user_outpos_ptr != NULL ? &outpos : NULL, len, size);
     if (result) {
-        kfree(buf);
         return result;
     }
 
-    kfree(buf);
+    /* The data has been copied, so there's no point failing now. */
+    if (user_inpos_ptr != NULL) {
+        copyout(&inpos, user_inpos_ptr, sizeof(inpos));
+    }
+    if (user_outpos_ptr != NULL) {
+        copyout(&outpos, user_outpos_ptr, sizeof(outpos));
+    }
+
     return 0;
 }
 
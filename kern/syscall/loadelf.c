@@ -42,8 +42,10 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
- * If you wanted to support memory-mapped executables you would need
- * to rearrange this to map each segment.
+ * Where the VM system allows, each segment is instead defined as a
+ * region backed by the executable (as_define_fileregion), so nothing
+ * is read until the program touches it. Segments the VM system can't
+ * map that way are loaded up front as above.
  *
  * To support dynamically linked executables with shared libraries
  * you'd need to change this to load the "ELF interpreter" (dynamic
@@ -145,6 +147,18 @@ load_segment(struct addrspace *as, struct vnode *v,
 	return result;
 }
 
+/*
+ * Whether segment PH can be read in page by page: its file offset has
+ * to be as far into a page as its address is.
+ */
+static
+bool
+load_mappable(const Elf_Phdr *ph)
+{
+	return ph->p_offset % PAGE_SIZE == ph->p_vaddr % PAGE_SIZE &&
+		ph->p_filesz <= ph->p_memsz;
+}
+
 /*
  * Load an ELF executable user program into the current address space.
  *
@@ -159,6 +173,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	struct iovec iov;
 	struct uio ku;
 	struct addrspace *as;
+	bool demand;
 
 	as = proc_getas();
 
@@ -217,6 +232,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
+	demand = true;
 	for (i=0; i<eh.e_phnum; i++) {
 		off_t offset = eh.e_phoff + i*eh.e_phentsize;
 		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
@@ -243,6 +259,24 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (demand && load_mappable(&ph)) {
+			result = as_define_fileregion(as,
+						      ph.p_vaddr, ph.p_memsz,
+						      v, ph.p_offset,
+						      ph.p_filesz,
+						      ph.p_flags & PF_R,
+						      ph.p_flags & PF_W,
+						      ph.p_flags & PF_X);
+			if (result != ENOSYS) {
+				if (result) {
+					return result;
+				}
+				continue;
+			}
+			/* No demand loading here; load everything below. */
+			demand = false;
+		}
+
 		result = as_define_region(as,
 					  ph.p_vaddr, ph.p_memsz,
 					  ph.p_flags & PF_R,
@@ -259,7 +293,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Now actually load each segment.
+	 * Now actually load each segment that isn't demand-loaded.
 	 */
 
 	for (i=0; i<eh.e_phnum; i++) {
@@ -288,6 +322,10 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
+		if (demand && load_mappable(&ph)) {
+			continue;
+		}
+
 		result = load_segment(as, v, ph.p_offset, ph.p_vaddr,
 				      ph.p_memsz, ph.p_filesz,
 				      ph.p_flags & PF_X);
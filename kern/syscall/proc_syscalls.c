@@ -95,3 +95,13 @@ int sys_waitpid(pid_t pid, int *status, int options, pid_t *ret_pid)
     *ret_pid = 0;
     return 0;
 }
+
+int sys_sbrk(intptr_t amount, vaddr_t *oldbreak)
+{
+    struct addrspace *as = proc_getas();
+
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    return as_sbrk(as, amount, oldbreak);
+}
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +57,48 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/* clocksleep takes an int. */
+#define NANOSLEEP_MAXSECS 0x7fffffff
+
+/*
+ * Sleep for the time in REQ. The clock only lets us sleep for whole
+ * seconds, so anything else is rounded up, and anything past
+ * NANOSLEEP_MAXSECS is cut down to it. We can't be woken early, so
+ * REM (if given) is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t req, userptr_t rem)
+{
+	struct timespec ts;
+	time_t secs;
+	int result;
+
+	result = copyin(req, &ts, sizeof(ts));
+	if (result) {
+		return result;
+	}
+	if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	secs = ts.tv_sec;
+	if (secs >= NANOSLEEP_MAXSECS) {
+		secs = NANOSLEEP_MAXSECS;
+	}
+	else if (ts.tv_nsec > 0) {
+		secs++;
+	}
+	clocksleep((int)secs);
+
+	if (rem != NULL) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 0;
+		result = copyout(&ts, rem, sizeof(ts));
+		if (result) {
+			return result;
+		}
+	}
+
+	return 0;
+}
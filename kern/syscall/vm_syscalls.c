@@ -0,0 +1,125 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/mman.h>
+#include <kern/vmstat.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <vnode.h>
+#include <proc.h>
+#include <current.h>
+#include <addrspace.h>
+#include <file_handle.h>
+#include <vm_syscalls.h>
+
+/*
+ * Map LEN bytes of the file open as FD (or zeros, for MAP_ANON) from
+ * OFFSET. The address the mapping ended up at goes in 'ret_addr'.
+ */
+int
+sys_mmap(userptr_t addr, size_t len, int prot, int flags, int fd,
+         off_t offset, vaddr_t *ret_addr)
+{
+    struct addrspace *as = proc_getas();
+    struct file_handle *fh;
+    struct vnode *vn;
+    vaddr_t va;
+    int accmode;
+    int result;
+
+    if (as == NULL) {
+        return ENOMEM;
+    }
+
+    /* Exactly one of MAP_SHARED and MAP_PRIVATE. */
+    if (((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0)) {
+        return EINVAL;
+    }
+
+    /* Shared mappings are shared through a file; there's no anonymous kind. */
+    if ((flags & MAP_SHARED) && (flags & MAP_ANON)) {
+        return EINVAL;
+    }
+
+    vn = NULL;
+    if (!(flags & MAP_ANON)) {
+        if (((unsigned)fd >= curproc->p_ft_size) || (fd < 0) ||
+            curproc->p_ft[fd] == NULL) {
+            return EBADF;
+        }
+        fh = curproc->p_ft[fd];
+
+        /* Shared writable mappings end up writing to the file. */
+        accmode = fh->fh_flags & O_ACCMODE;
+        if (accmode == O_WRONLY) {
+            return EACCES;
+        }
+        if ((flags & MAP_SHARED) && (prot & PROT_WRITE) &&
+            accmode != O_RDWR) {
+            return EACCES;
+        }
+
+        vn = fh->fh_file_obj;
+        result = VOP_MMAP(vn, prot);
+        if (result) {
+            return result;
+        }
+    }
+
+    va = (vaddr_t)addr;
+    result = as_mmap(as, &va, len, prot, flags, vn, offset);
+    if (result) {
+        return result;
+    }
+
+    *ret_addr = va;
+    return 0;
+}
+
+int
+sys_munmap(userptr_t addr, size_t len)
+{
+    struct addrspace *as = proc_getas();
+
+    if (as == NULL) {
+        return EINVAL;
+    }
+    return as_munmap(as, (vaddr_t)addr, len);
+}
+
+/*
+ * Changes are always written back before this returns, so MS_ASYNC
+ * is the same as MS_SYNC.
+ */
+int
+sys_msync(userptr_t addr, size_t len, int flags)
+{
+    struct addrspace *as = proc_getas();
+
+    if ((flags & MS_ASYNC) && (flags & MS_SYNC)) {
+        return EINVAL;
+    }
+    if (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) {
+        return EINVAL;
+    }
+    if (as == NULL) {
+        return ENOMEM;
+    }
+    return as_msync(as, (vaddr_t)addr, len);
+}
+
+/*
+ * Copy the VM statistics out to 'buf'.
+ */
+int
+sys_vmstat(userptr_t buf)
+{
+    struct vmstat vs;
+    int result;
+
+    result = vm_getstats(&vs);
+    if (result) {
+        return result;
+    }
+    return copyout(&vs, buf, sizeof(vs));
+}
@@ -40,6 +40,7 @@
 #include <test.h>
 #include <kern/test161.h>
 #include <mainbus.h>
+#include <clock.h>
 
 #include "opt-dumbvm.h"
 
@@ -605,3 +606,181 @@ kmalloctest5(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+// km6
+
+#define KM6_BLOCKSIZE 1000	/* lands in the 1024-byte pool */
+#define KM6_PERPAGE (PAGE_SIZE / 1024)
+#define KM6_DEFAULT_PAGES 1000
+#define KM6_MAXSLOWDOWN 3	/* the heap grows 8x; a search would too */
+
+/*
+ * Fill NPAGES heap pages with blocks, then time freeing one block
+ * from each page, oldest page first. The pages all stay in use, so
+ * this measures only the cost of finding the page a pointer is on.
+ * Returns the average time per kfree in nanoseconds.
+ */
+static
+unsigned
+km6_round(void **ptrs, unsigned npages)
+{
+	struct timespec before, after, diff;
+	unsigned i, nblocks;
+	uint64_t ns;
+
+	nblocks = npages * KM6_PERPAGE;
+	for (i=0; i<nblocks; i++) {
+		ptrs[i] = kmalloc(KM6_BLOCKSIZE);
+		if (ptrs[i] == NULL) {
+			panic("km6: kmalloc failed after %u blocks\n", i);
+		}
+	}
+
+	gettime(&before);
+	for (i=0; i<nblocks; i+=KM6_PERPAGE) {
+		kfree(ptrs[i]);
+	}
+	gettime(&after);
+
+	for (i=0; i<nblocks; i++) {
+		if (i % KM6_PERPAGE != 0) {
+			kfree(ptrs[i]);
+		}
+	}
+
+	timespec_sub(&after, &before, &diff);
+	ns = diff.tv_sec * (uint64_t)1000000000 + diff.tv_nsec;
+	return ns / npages;
+}
+
+/*
+ * Check that kfree doesn't get slower as the heap grows, by timing it
+ * on heaps of 1/8, 1/4, 1/2 and all of the requested number of live
+ * heap pages. With a per-page lookup the times should be about flat;
+ * with a search of the heap they grow with the page count. The test
+ * fails if the largest heap is more than KM6_MAXSLOWDOWN times slower
+ * per kfree than the smallest.
+ */
+int
+kmalloctest6(int nargs, char **args)
+{
+	unsigned npages, n, t, first;
+	void **ptrs;
+
+	if (nargs > 2) {
+		kprintf("usage: km6 [npages]\n");
+		return 0;
+	}
+	npages = nargs == 2 ? atoi(args[1]) : KM6_DEFAULT_PAGES;
+	if (npages < 8) {
+		npages = 8;
+	}
+
+	ptrs = kmalloc(npages * KM6_PERPAGE * sizeof(void *));
+	if (ptrs == NULL) {
+		panic("km6: can't allocate pointer array\n");
+	}
+
+	kprintf("km6: timing kfree with up to %u live heap pages\n", npages);
+
+	first = 0;
+	for (n = npages/8; n <= npages; n *= 2) {
+		t = km6_round(ptrs, n);
+		kprintf("km6: %5u pages: %u ns per kfree\n", n, t);
+		if (first == 0) {
+			first = t;
+		}
+		if (n == npages) {
+			break;
+		}
+		if (n * 2 > npages) {
+			n = npages / 2;
+		}
+	}
+
+	kfree(ptrs);
+
+	kprintf("km6: largest heap took %u.%02ux as long per kfree as smallest\n",
+		first ? t / first : 0, first ? (t * 100 / first) % 100 : 0);
+	if (t <= first * KM6_MAXSLOWDOWN) {
+		success(TEST161_SUCCESS, SECRET, "km6");
+	}
+	else {
+		success(TEST161_FAIL, SECRET, "km6");
+	}
+
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+// km7
+
+#define KM7_BLOCKSIZE 1000	/* lands in the 1024-byte pool */
+#define KM7_PERPAGE (PAGE_SIZE / 1024)
+#define KM7_DEFAULT_PAGES 5000
+#define KM7_ITERATIONS 3
+
+/*
+ * The kernel heap used to be able to manage at most 16 pages' worth
+ * of pagerefs, 256 each, or 4096 heap pages. Allocate well past that,
+ * three times over so the later rounds reuse pagerefs freed by the
+ * earlier ones.
+ *
+ * The blocks are chained together through their first word, so the
+ * test needs no pointer array of its own.
+ */
+struct km7block {
+	struct km7block *next;
+	unsigned magic;
+};
+
+int
+kmalloctest7(int nargs, char **args)
+{
+	struct km7block *head, *b;
+	unsigned npages, nblocks, i, iter;
+
+	if (nargs > 2) {
+		kprintf("usage: km7 [npages]\n");
+		return 0;
+	}
+	npages = nargs == 2 ? atoi(args[1]) : KM7_DEFAULT_PAGES;
+	nblocks = npages * KM7_PERPAGE;
+
+	kprintf("km7: allocating %u heap pages, %u times\n", npages,
+		KM7_ITERATIONS);
+
+	for (iter=0; iter<KM7_ITERATIONS; iter++) {
+		head = NULL;
+		for (i=0; i<nblocks; i++) {
+			b = kmalloc(KM7_BLOCKSIZE);
+			if (b == NULL) {
+				panic("km7: kmalloc failed after %u heap pages\n",
+				      i / KM7_PERPAGE);
+			}
+			b->next = head;
+			b->magic = i;
+			head = b;
+			if (i % (nblocks / 8 + 1) == 0) {
+				kprintf(".");
+			}
+		}
+
+		while (head != NULL) {
+			b = head;
+			head = b->next;
+			if (b->magic != --i) {
+				panic("km7: block %p: expected %u, got %u\n",
+				      b, i, b->magic);
+			}
+			kfree(b);
+		}
+		KASSERT(i == 0);
+	}
+
+	kprintf("\n");
+	success(TEST161_SUCCESS, SECRET, "km7");
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * Test code for the typed object caches.
+ */
+#include <types.h>
+#include <lib.h>
+#include <vm.h> /* for PAGE_SIZE */
+#include <kmem_cache.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define KC1_OBJSIZE     40
+#define KC1_SLABS       3
+#define KC1_MAGIC       0xcafe0b1e
+
+struct kc1_obj {
+    uint32_t magic;                 /* Set by the constructor. */
+    uint32_t ctor_serial;           /* Which constructor call made us. */
+    char pad[KC1_OBJSIZE - 2 * sizeof(uint32_t)];
+};
+
+static unsigned kc1_ctor_calls;
+
+static
+void
+kc1_ctor(void *obj)
+{
+    struct kc1_obj *o = obj;
+
+    o->magic = KC1_MAGIC;
+    o->ctor_serial = kc1_ctor_calls++;
+}
+
+/*
+ * kc1: check that objects are packed at their exact size, that the
+ * constructor runs once per object rather than once per allocation, and
+ * that freed objects are handed out again in their constructed state.
+ */
+int
+kmemcachetest(int nargs, char **args)
+{
+    struct kmem_cache *kc;
+    struct kc1_obj **objs;
+    unsigned perslab, nobjs, calls;
+
+    (void)nargs;
+    (void)args;
+
+    kprintf("Starting kmem_cache test...\n");
+
+    kc1_ctor_calls = 0;
+    kc = kmem_cache_create("kc1", sizeof(struct kc1_obj), kc1_ctor);
+    if (kc == NULL) {
+        panic("kc1: kmem_cache_create failed\n");
+    }
+
+    /* 40-byte objects would take 64 bytes each from kmalloc. */
+    perslab = kc->kc_perslab;
+    kprintf("kc1: %u objects of %zu bytes per slab\n", perslab,
+            kc->kc_objsize);
+    if (kc->kc_objsize != KC1_OBJSIZE || perslab <= PAGE_SIZE / 64) {
+        panic("kc1: objects not packed at their exact size\n");
+    }
+
+    nobjs = perslab * KC1_SLABS;
+    objs = kmalloc(nobjs * sizeof(*objs));
+    if (objs == NULL) {
+        panic("kc1: out of memory\n");
+    }
+
+    for (unsigned i = 0; i < nobjs; ++i) {
+        objs[i] = kmem_cache_alloc(kc);
+        if (objs[i] == NULL) {
+            panic("kc1: kmem_cache_alloc failed\n");
+        }
+        if (objs[i]->magic != KC1_MAGIC) {
+            panic("kc1: object %p not constructed\n", objs[i]);
+        }
+        if (((vaddr_t)objs[i] & PAGE_FRAME) !=
+            (((vaddr_t)objs[i] + KC1_OBJSIZE - 1) & PAGE_FRAME)) {
+            panic("kc1: object %p crosses a page boundary\n", objs[i]);
+        }
+        /* Scribble on the payload, but leave the constructed fields. */
+        memset(objs[i]->pad, i & 0xff, sizeof(objs[i]->pad));
+    }
+
+    if (kc1_ctor_calls != nobjs || kc->kc_nslabs != KC1_SLABS) {
+        panic("kc1: %u constructor calls, %u slabs for %u objects\n",
+              kc1_ctor_calls, kc->kc_nslabs, nobjs);
+    }
+
+    for (unsigned i = 0; i < nobjs; ++i) {
+        kmem_cache_free(kc, objs[i]);
+    }
+    if (kc->kc_inuse != 0 || kc->kc_nslabs != 1) {
+        panic("kc1: %u objects in use, %u slabs held after freeing\n",
+              kc->kc_inuse, kc->kc_nslabs);
+    }
+
+    /* One slab's worth comes back from the held slab without a ctor call. */
+    calls = kc1_ctor_calls;
+    for (unsigned i = 0; i < perslab; ++i) {
+        objs[i] = kmem_cache_alloc(kc);
+        if (objs[i] == NULL) {
+            panic("kc1: kmem_cache_alloc failed\n");
+        }
+        if (objs[i]->magic != KC1_MAGIC) {
+            panic("kc1: reused object %p lost its constructed state\n",
+                  objs[i]);
+        }
+    }
+    if (kc1_ctor_calls != calls) {
+        panic("kc1: constructor ran again on reused objects\n");
+    }
+    for (unsigned i = 0; i < perslab; ++i) {
+        kmem_cache_free(kc, objs[i]);
+    }
+
+    kfree(objs);
+    kmem_cache_destroy(kc);
+
+    kprintf("\n");
+    success(TEST161_SUCCESS, SECRET, "kc1");
+
+    return 0;
+}
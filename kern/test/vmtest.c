@@ -0,0 +1,157 @@
+/*
+ * Tests for the VM system. These build a user address space by hand
+ * and run in it from the menu thread.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <copyinout.h>
+#include <vm.h>
+#include <test.h>
+#include <kern/test161.h>
+
+#define VM1_DATA        0x400000    /* Where the fake data segment goes. */
+#define VM1_PAGES       32          /* Pages to grow the heap by. */
+#define VM1_ROUNDS      8
+
+/*
+ * Set up an address space with one page of data, a heap and a stack,
+ * and switch to it. Returns the old one.
+ */
+static
+struct addrspace *
+vmtest_enter(struct addrspace **ret)
+{
+    struct addrspace *as;
+    vaddr_t sp;
+
+    as = as_create();
+    if (as == NULL) {
+        panic("vmtest: as_create failed\n");
+    }
+    if (as_define_region(as, VM1_DATA, PAGE_SIZE, 1, 1, 0) ||
+        as_prepare_load(as) || as_complete_load(as) ||
+        as_define_stack(as, &sp)) {
+        panic("vmtest: setting up the address space failed\n");
+    }
+
+    *ret = as;
+    as = proc_setas(as);
+    as_activate();
+    return as;
+}
+
+static
+void
+vmtest_leave(struct addrspace *old)
+{
+    struct addrspace *as;
+
+    as_deactivate();
+    as = proc_setas(old);
+    as_activate();
+    as_destroy(as);
+}
+
+/*
+ * vm1: grow the heap, touch it, shrink it again, and check that the
+ * memory in use goes up only once the pages are touched and comes
+ * back down as soon as they're given back.
+ */
+int
+sbrktest(int nargs, char **args)
+{
+    struct addrspace *as, *old;
+    vaddr_t base, brk;
+    unsigned used0, used, val;
+    int result;
+
+    (void)nargs;
+    (void)args;
+
+    kprintf("Starting sbrk test...\n");
+
+    old = vmtest_enter(&as);
+
+    if (as_sbrk(as, 0, &base)) {
+        panic("vm1: no heap\n");
+    }
+    if (base != VM1_DATA + PAGE_SIZE) {
+        panic("vm1: heap starts at 0x%x, not after the data\n", base);
+    }
+    if (as_sbrk(as, PAGE_SIZE / 2, &brk) != EINVAL) {
+        panic("vm1: sbrk took a partial page\n");
+    }
+    if (as_sbrk(as, -PAGE_SIZE, &brk) != EINVAL) {
+        panic("vm1: sbrk shrank below the start of the heap\n");
+    }
+
+    /* Page table pages stay around, so measure after the first round. */
+    used0 = 0;
+    for (unsigned round = 0; round < VM1_ROUNDS; ++round) {
+        used = coremap_used_bytes();
+        result = as_sbrk(as, VM1_PAGES * PAGE_SIZE, &brk);
+        if (result) {
+            panic("vm1: sbrk: %s\n", strerror(result));
+        }
+        if (brk != base) {
+            panic("vm1: sbrk returned 0x%x, expected 0x%x\n", brk, base);
+        }
+        if (coremap_used_bytes() > used) {
+            panic("vm1: growing the heap allocated memory\n");
+        }
+
+        for (unsigned i = 0; i < VM1_PAGES; ++i) {
+            val = round * VM1_PAGES + i;
+            result = copyout(&val, (userptr_t)(base + i * PAGE_SIZE),
+                             sizeof(val));
+            if (result) {
+                panic("vm1: touching heap page %u: %s\n", i,
+                      strerror(result));
+            }
+        }
+        if (coremap_used_bytes() < used + VM1_PAGES * PAGE_SIZE) {
+            panic("vm1: touching %u heap pages used only %u bytes\n",
+                  VM1_PAGES, coremap_used_bytes() - used);
+        }
+        for (unsigned i = 0; i < VM1_PAGES; ++i) {
+            result = copyin((const_userptr_t)(base + i * PAGE_SIZE), &val,
+                            sizeof(val));
+            if (result || val != round * VM1_PAGES + i) {
+                panic("vm1: heap page %u lost its contents\n", i);
+            }
+        }
+
+        result = as_sbrk(as, -VM1_PAGES * PAGE_SIZE, &brk);
+        if (result) {
+            panic("vm1: sbrk: %s\n", strerror(result));
+        }
+        if (brk != base + VM1_PAGES * PAGE_SIZE) {
+            panic("vm1: shrinking returned 0x%x\n", brk);
+        }
+
+        used = coremap_used_bytes();
+        if (round == 0) {
+            used0 = used;
+        }
+        else if (used > used0) {
+            panic("vm1: round %u: %u bytes still in use after shrinking\n",
+                  round, used - used0);
+        }
+        kprintf(".");
+    }
+
+    /* A page that's been given back isn't there any more. */
+    if (copyin((const_userptr_t)base, &val, sizeof(val)) != EFAULT) {
+        panic("vm1: freed heap page is still mapped\n");
+    }
+
+    vmtest_leave(old);
+
+    kprintf("\n");
+    success(TEST161_SUCCESS, SECRET, "vm1");
+
+    return 0;
+}
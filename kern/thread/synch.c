@@ -39,6 +39,15 @@
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <kmem_cache.h>
+
+/* Object caches for the synchronization primitives. */
+static struct kmem_cache sem_cache =
+	KMEM_CACHE_INITIALIZER("semaphore", sizeof(struct semaphore), NULL);
+static struct kmem_cache lock_cache =
+	KMEM_CACHE_INITIALIZER("lock", sizeof(struct lock), NULL);
+static struct kmem_cache cv_cache =
+	KMEM_CACHE_INITIALIZER("cv", sizeof(struct cv), NULL);
 
 ////////////////////////////////////////////////////////////
 //
@@ -49,21 +58,21 @@ sem_create(const char *name, unsigned initial_count)
 {
 	struct semaphore *sem;
 
-	sem = kmalloc(sizeof(*sem));
+	sem = kmem_cache_alloc(&sem_cache);
 	if (sem == NULL) {
 		return NULL;
 	}
 
 	sem->sem_name = kstrdup(name);
 	if (sem->sem_name == NULL) {
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
 	sem->sem_wchan = wchan_create(sem->sem_name);
 	if (sem->sem_wchan == NULL) {
 		kfree(sem->sem_name);
-		kfree(sem);
+		kmem_cache_free(&sem_cache, sem);
 		return NULL;
 	}
 
@@ -82,7 +91,7 @@ sem_destroy(struct semaphore *sem)
 	spinlock_cleanup(&sem->sem_lock);
 	wchan_destroy(sem->sem_wchan);
 	kfree(sem->sem_name);
-	kfree(sem);
+	kmem_cache_free(&sem_cache, sem);
 }
 
 void
@@ -143,14 +152,14 @@ lock_create(const char *name)
 {
 	struct lock *lock;
 
-	lock = kmalloc(sizeof(*lock));
+	lock = kmem_cache_alloc(&lock_cache);
 	if (lock == NULL) {
 		return NULL;
 	}
 
 	lock->lk_name = kstrdup(name);
 	if (lock->lk_name == NULL) {
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 
@@ -164,7 +173,7 @@ lock_create(const char *name)
 	if (lock->lk_wchan == NULL) {
 		kfree(lock->lk_name);
 		spinlock_cleanup(&lock->lk_splock);
-		kfree(lock);
+		kmem_cache_free(&lock_cache, lock);
 		return NULL;
 	}
 
@@ -181,7 +190,7 @@ lock_destroy(struct lock *lock)
 	kfree(lock->lk_name);
 	spinlock_cleanup(&lock->lk_splock);
 	wchan_destroy(lock->lk_wchan);
-	kfree(lock);
+	kmem_cache_free(&lock_cache, lock);
 }
 
 void
@@ -232,6 +241,27 @@ lock_do_i_hold(struct lock *lock)
 	return (lock->lk_thread == curthread);
 }
 
+bool
+lock_tryacquire(struct lock *lock)
+{
+	KASSERT(lock != NULL);
+
+	spinlock_acquire(&lock->lk_splock);
+
+	if (lock->lk_thread != NULL) {
+		spinlock_release(&lock->lk_splock);
+		return false;
+	}
+
+	/* Never waits, but hangman wants to see a wait before an acquire. */
+	HANGMAN_WAIT(&curthread->t_hangman, &lock->lk_hangman);
+	lock->lk_thread = curthread;
+	HANGMAN_ACQUIRE(&curthread->t_hangman, &lock->lk_hangman);
+
+	spinlock_release(&lock->lk_splock);
+	return true;
+}
+
 ////////////////////////////////////////////////////////////
 //
 // CV
@@ -242,14 +272,14 @@ cv_create(const char *name)
 {
 	struct cv *cv;
 
-	cv = kmalloc(sizeof(*cv));
+	cv = kmem_cache_alloc(&cv_cache);
 	if (cv == NULL) {
 		return NULL;
 	}
 
 	cv->cv_name = kstrdup(name);
 	if (cv->cv_name==NULL) {
-		kfree(cv);
+		kmem_cache_free(&cv_cache, cv);
 		return NULL;
 	}
 
@@ -259,7 +289,7 @@ cv_create(const char *name)
 	if (cv->cv_wchan == NULL) {
 		kfree(cv->cv_name);
 		spinlock_cleanup(&cv->cv_splock);
-		kfree(cv);
+		kmem_cache_free(&cv_cache, cv);
 		return NULL;
 	}
 
@@ -275,7 +305,7 @@ cv_destroy(struct cv *cv)
 	kfree(cv->cv_name);
 	spinlock_cleanup(&cv->cv_splock);
 	wchan_destroy(cv->cv_wchan);
-	kfree(cv);
+	kmem_cache_free(&cv_cache, cv);
 }
 
 void
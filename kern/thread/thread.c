@@ -48,8 +48,10 @@
 #include <current.h>
 #include <synch.h>
 #include <addrspace.h>
+#include <vm.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <kmem_cache.h>
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -61,6 +63,14 @@ struct wchan {
 	struct threadlist wc_threads;	/* list of waiting threads */
 };
 
+static void wchan_ctor(void *obj);
+
+/* Object caches for threads and wait channels. */
+static struct kmem_cache thread_cache =
+	KMEM_CACHE_INITIALIZER("thread", sizeof(struct thread), NULL);
+static struct kmem_cache wchan_cache =
+	KMEM_CACHE_INITIALIZER("wchan", sizeof(struct wchan), wchan_ctor);
+
 /* Master array of CPUs. */
 DECLARRAY(cpu, static __UNUSED inline);
 DEFARRAY(cpu, static __UNUSED inline);
@@ -129,7 +139,7 @@ thread_create(const char *name)
 		return NULL;
 	}
 
-	thread = kmalloc(sizeof(*thread));
+	thread = kmem_cache_alloc(&thread_cache);
 	if (thread == NULL) {
 		return NULL;
 	}
@@ -191,6 +201,8 @@ cpu_create(unsigned hardware_number)
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
+	c->c_shootdownall = false;
+	c->c_shootdowndone = 0;
 	spinlock_init(&c->c_ipi_lock);
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
@@ -286,7 +298,7 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread);
+	kmem_cache_free(&thread_cache, thread);
 }
 
 /*
@@ -640,7 +652,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 	cur->t_state = newstate;
 
 	/*
-	 * Get the next thread. While there isn't one, call cpu_idle().
+	 * Get the next thread. While there isn't one, call cpu_idle(),
+	 * unless the VM system has some work for an idle CPU; then
+	 * look at the runqueue again after each bit of it.
 	 * curcpu->c_isidle must be true when cpu_idle is
 	 * called. Unlock the runqueue while idling too, to make sure
 	 * things can be added to it.
@@ -662,7 +676,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc, struct spinlock *lk)
 		next = threadlist_remhead(&curcpu->c_runqueue);
 		if (next == NULL) {
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			if (!vm_idle()) {
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
@@ -988,6 +1004,20 @@ thread_consider_migration(void)
  * Wait channel functions
  */
 
+/*
+ * Constructor for wchan_cache. The thread list is empty again (and thus
+ * still initialized) whenever a wait channel is destroyed, so this only
+ * needs to run once per object.
+ */
+static
+void
+wchan_ctor(void *obj)
+{
+	struct wchan *wc = obj;
+
+	threadlist_init(&wc->wc_threads);
+}
+
 /*
  * Create a wait channel. NAME is a symbolic string name for it.
  * This is what's displayed by ps -alx in Unix.
@@ -1001,11 +1031,11 @@ wchan_create(const char *name)
 {
 	struct wchan *wc;
 
-	wc = kmalloc(sizeof(*wc));
+	wc = kmem_cache_alloc(&wchan_cache);
 	if (wc == NULL) {
 		return NULL;
 	}
-	threadlist_init(&wc->wc_threads);
+	KASSERT(threadlist_isempty(&wc->wc_threads));
 	wc->wc_name = name;
 
 	return wc;
@@ -1018,8 +1048,9 @@ wchan_create(const char *name)
 void
 wchan_destroy(struct wchan *wc)
 {
+	/* This only checks the list is empty; it stays initialized. */
 	threadlist_cleanup(&wc->wc_threads);
-	kfree(wc);
+	kmem_cache_free(&wchan_cache, wc);
 }
 
 /*
@@ -1160,37 +1191,95 @@ ipi_broadcast(int code)
 }
 
 /*
- * Send a TLB shootdown IPI to the specified CPU.
+ * Queue a TLB shootdown for TARGET without interrupting it. Call with
+ * the target's IPI lock held.
  */
+static
 void
-ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+ipi_tlbshootdown_enqueue(struct cpu *target, const struct tlbshootdown *mapping)
 {
 	unsigned n;
 
-	spinlock_acquire(&target->c_ipi_lock);
+	KASSERT(spinlock_do_i_hold(&target->c_ipi_lock));
 
 	n = target->c_numshootdown;
 	if (n == TLBSHOOTDOWN_MAX) {
 		/*
-		 * If you have problems with this panic going off,
-		 * consider: (1) increasing the maximum, (2) putting
-		 * logic here to sleep until space appears (may
-		 * interact awkwardly with VM system locking), (3)
-		 * putting logic here to coalesce requests together,
-		 * and/or (4) improving VM system state tracking to
-		 * reduce the number of unnecessary shootdowns.
+		 * Out of room. Coalesce everything queued into a
+		 * flush of the whole TLB rather than panicking.
 		 */
-		panic("ipi_tlbshootdown: Too many shootdowns queued\n");
+		target->c_shootdownall = true;
 	}
 	else {
 		target->c_shootdown[n] = *mapping;
 		target->c_numshootdown = n+1;
 	}
+}
+
+/*
+ * Send a TLB shootdown IPI to the specified CPU.
+ */
+void
+ipi_tlbshootdown(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+
+	ipi_tlbshootdown_enqueue(target, mapping);
+	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
+	mainbus_send_ipi(target);
 
+	spinlock_release(&target->c_ipi_lock);
+}
+
+void
+ipi_tlbshootdown_queue(struct cpu *target, const struct tlbshootdown *mapping)
+{
+	spinlock_acquire(&target->c_ipi_lock);
+	ipi_tlbshootdown_enqueue(target, mapping);
+	spinlock_release(&target->c_ipi_lock);
+}
+
+unsigned
+ipi_tlbshootdown_send(struct cpu *target)
+{
+	unsigned ticket;
+
+	spinlock_acquire(&target->c_ipi_lock);
+
+	/* Done once the queue has been processed after this. */
+	ticket = target->c_shootdowndone + 1;
 	target->c_ipi_pending |= (uint32_t)1 << IPI_TLBSHOOTDOWN;
 	mainbus_send_ipi(target);
 
 	spinlock_release(&target->c_ipi_lock);
+
+	return ticket;
+}
+
+void
+ipi_tlbshootdown_wait(struct cpu *target, unsigned ticket)
+{
+	bool done;
+
+	KASSERT(curthread->t_curspl == 0);
+	KASSERT(curcpu->c_spinlocks == 0);
+
+	do {
+		/* Releasing the lock lets our own IPIs in. */
+		spinlock_acquire(&target->c_ipi_lock);
+		done = (int)(target->c_shootdowndone - ticket) >= 0;
+		spinlock_release(&target->c_ipi_lock);
+	} while (!done);
+}
+
+/*
+ * Look up a CPU by number.
+ */
+struct cpu *
+cpu_bynumber(unsigned num)
+{
+	KASSERT(num < cpuarray_num(&allcpus));
+	return cpuarray_get(&allcpus, num);
 }
 
 /*
@@ -1233,10 +1322,18 @@ interprocessor_interrupt(void)
 		 * need to release the ipi lock while calling
 		 * vm_tlbshootdown.
 		 */
-		for (i=0; i<curcpu->c_numshootdown; i++) {
-			vm_tlbshootdown(&curcpu->c_shootdown[i]);
+		if (curcpu->c_shootdownall) {
+			/* NULL means everything */
+			vm_tlbshootdown(NULL);
+		}
+		else {
+			for (i=0; i<curcpu->c_numshootdown; i++) {
+				vm_tlbshootdown(&curcpu->c_shootdown[i]);
+			}
 		}
 		curcpu->c_numshootdown = 0;
+		curcpu->c_shootdownall = false;
+		curcpu->c_shootdowndone++;
 	}
 
 	curcpu->c_ipi_pending = 0;
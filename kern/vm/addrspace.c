@@ -27,12 +27,22 @@
  * SUCH DAMAGE.
  */
 
+#define ASINLINE
+
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/mman.h>
+#include <kern/stat.h>
 #include <lib.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
 #include <addrspace.h>
 #include <vm.h>
 #include <proc.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vmprivate.h>
 
 /*
  * Note! If OPT_DUMBVM is set, as is the case until you start the VM
@@ -43,77 +53,611 @@
 struct addrspace *
 as_create(void)
 {
-	struct addrspace *as;
+    struct addrspace *as;
+
+    as = kmalloc(sizeof(struct addrspace));
+    if (as == NULL) {
+        return NULL;
+    }
+
+    as->as_lock = lock_create("addrspace");
+    if (as->as_lock == NULL) {
+        kfree(as);
+        return NULL;
+    }
+
+    as->as_pt = pt_create();
+    if (as->as_pt == NULL) {
+        lock_destroy(as->as_lock);
+        kfree(as);
+        return NULL;
+    }
+
+    regionarray_init(&as->as_regions);
+    as->as_lastregion = NULL;
+    as->as_heap = NULL;
+    as->as_loading = false;
+    for (unsigned i = 0; i < MAXCPUS; ++i) {
+        as->as_asid[i] = 0;
+    }
+
+    return as;
+}
+
+/*
+ * Index of the first region that ends above VA, or the number of
+ * regions if there isn't one.
+ */
+static
+unsigned
+as_searchregion(struct addrspace *as, vaddr_t va)
+{
+    struct region *rg;
+    unsigned lo, hi, mid;
+
+    lo = 0;
+    hi = regionarray_num(&as->as_regions);
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        rg = regionarray_get(&as->as_regions, mid);
+        if (va < rg->rg_base + rg->rg_npages * PAGE_SIZE) {
+            hi = mid;
+        }
+        else {
+            lo = mid + 1;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Add a region to the address space, handing it back in *RET if RET
+ * isn't NULL. Regions may not overlap.
+ */
+static
+int
+as_addregion(struct addrspace *as, vaddr_t base, size_t npages, int perms,
+             struct region **ret)
+{
+    struct region *rg;
+    unsigned i, num, pos;
+    int result;
+
+    /* Only the region that ends first above BASE can overlap. */
+    num = regionarray_num(&as->as_regions);
+    pos = as_searchregion(as, base);
+    if (pos < num) {
+        rg = regionarray_get(&as->as_regions, pos);
+        if (rg->rg_base < base + npages * PAGE_SIZE) {
+            return EINVAL;
+        }
+    }
+
+    rg = kmalloc(sizeof(*rg));
+    if (rg == NULL) {
+        return ENOMEM;
+    }
+    rg->rg_base = base;
+    rg->rg_npages = npages;
+    rg->rg_perms = perms;
+    rg->rg_flags = 0;
+    rg->rg_vnode = NULL;
+    rg->rg_offset = 0;
+    rg->rg_filesize = 0;
+    rg->rg_fanext = 0;
+    rg->rg_fawindow = 1;
+    rg->rg_faahead = 0;
+
+    result = regionarray_setsize(&as->as_regions, num + 1);
+    if (result) {
+        kfree(rg);
+        return result;
+    }
+    for (i = num; i > pos; --i) {
+        regionarray_set(&as->as_regions, i,
+                        regionarray_get(&as->as_regions, i - 1));
+    }
+    regionarray_set(&as->as_regions, pos, rg);
+
+    if (ret != NULL) {
+        *ret = rg;
+    }
+    return 0;
+}
+
+/*
+ * Remove the region at index POS and let go of its file.
+ */
+static
+void
+as_removeregion(struct addrspace *as, unsigned pos)
+{
+    struct region *rg;
+
+    rg = regionarray_get(&as->as_regions, pos);
+    regionarray_remove(&as->as_regions, pos);
+    if (as->as_lastregion == rg) {
+        as->as_lastregion = NULL;
+    }
+    if (rg->rg_vnode != NULL) {
+        VOP_DECREF(rg->rg_vnode);
+    }
+    kfree(rg);
+}
 
-	as = kmalloc(sizeof(struct addrspace));
-	if (as == NULL) {
-		return NULL;
-	}
+struct region *
+as_findregion(struct addrspace *as, vaddr_t va)
+{
+    struct region *rg;
+    unsigned pos;
 
-	/*
-	 * Initialize as needed.
-	 */
+    rg = as->as_lastregion;
+    if (rg != NULL && va >= rg->rg_base &&
+        va < rg->rg_base + rg->rg_npages * PAGE_SIZE) {
+        return rg;
+    }
 
-	return as;
+    pos = as_searchregion(as, va);
+    if (pos == regionarray_num(&as->as_regions)) {
+        return NULL;
+    }
+    rg = regionarray_get(&as->as_regions, pos);
+    if (va < rg->rg_base) {
+        return NULL;
+    }
+
+    as->as_lastregion = rg;
+    return rg;
+}
+
+struct as_copyinfo {
+    struct addrspace *ci_newas;
+    bool ci_writable;               /* Region is writable. */
+    bool ci_shared;                 /* Region is a shared mapping. */
+};
+
+/*
+ * Bring every page of AS's shared mappings into a frame of its own,
+ * so as_copy can share the frames themselves: a page left in swap or
+ * on disk would be read into a separate frame by each address space.
+ *
+ * Called with as_lock held. Pages can't be allocated with it held, so
+ * when one is needed this lets go, gets one, and takes it again, like
+ * vm_fault. Pageout may take back pages brought in before while it's
+ * let go, so it goes round until a pass needs no pages.
+ */
+static
+int
+as_sharedin(struct addrspace *as)
+{
+    struct region *rg;
+    unsigned i, num;
+    vaddr_t va, end;
+    pte_t *pte;
+    paddr_t spare;
+    bool again;
+    int result;
+
+    spare = 0;
+    result = 0;
+    num = regionarray_num(&as->as_regions);
+    do {
+        again = false;
+        for (i = 0; i < num && result == 0; ++i) {
+            rg = regionarray_get(&as->as_regions, i);
+            if (!(rg->rg_flags & RGF_SHARED)) {
+                continue;
+            }
+            end = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+            for (va = rg->rg_base; va < end && result == 0; va += PAGE_SIZE) {
+                pte = pt_get(as->as_pt, va, true);
+                if (pte == NULL) {
+                    result = ENOMEM;
+                    continue;
+                }
+                if ((*pte & PTE_PRESENT) && !(*pte & PTE_ZERO)) {
+                    continue;
+                }
+                if (spare == 0) {
+                    lock_release(as->as_lock);
+                    spare = coremap_alloc_upage(as, va);
+                    lock_acquire(as->as_lock);
+                    if (spare == 0) {
+                        result = ENOMEM;
+                        continue;
+                    }
+                    again = true;
+                }
+                result = vm_sharedin(as, rg, va, pte, &spare);
+            }
+        }
+    } while (again && result == 0);
+
+    if (spare != 0) {
+        coremap_free_upage(spare);
+    }
+    return result;
+}
+
+/*
+ * pt_foreach callback for as_copy: share each page with the new
+ * address space, copy-on-write if it's in a writable region. (Being
+ * writable, it may be mapped read-only only because it's clean.)
+ *
+ * A shared mapping's pages stay shared for good, so they share the
+ * frame itself; as_sharedin has put them all in frames. Its PTE_DIRTY
+ * stays with the old address space, which writes it back; the new one
+ * maps it read-only until it writes too.
+ */
+static
+int
+as_sharepage(vaddr_t va, pte_t *pte, void *data)
+{
+    struct as_copyinfo *ci = data;
+    pte_t *newpte;
+
+    if (!(*pte & (PTE_PRESENT | PTE_SWAPPED))) {
+        return 0;
+    }
+
+    newpte = pt_get(ci->ci_newas->as_pt, va, true);
+    if (newpte == NULL) {
+        return ENOMEM;
+    }
+    if (ci->ci_shared) {
+        KASSERT((*pte & PTE_PRESENT) && !(*pte & PTE_ZERO));
+        coremap_share(*pte & PTE_FRAME);
+        *newpte = *pte & ~(PTE_WRITE | PTE_DIRTY);
+        return 0;
+    }
+    if (*pte & PTE_SWAPPED) {
+        /* Whoever reads it back in first gets a private copy. */
+        swap_share(PTE_SLOT(*pte));
+    }
+    else if (!(*pte & PTE_ZERO)) {
+        /* The zero page isn't counted; anything else is. */
+        if (ci->ci_writable) {
+            *pte = (*pte & ~PTE_WRITE) | PTE_COW;
+        }
+        coremap_share(*pte & PTE_FRAME);
+    }
+    *newpte = *pte;
+
+    return 0;
 }
 
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
-	struct addrspace *newas;
+    struct addrspace *newas;
+    struct as_copyinfo ci;
+    struct region *rg, *newrg;
+    unsigned i, num;
+    int result;
+
+    newas = as_create();
+    if (newas==NULL) {
+        return ENOMEM;
+    }
+
+    lock_acquire(old->as_lock);
 
-	newas = as_create();
-	if (newas==NULL) {
-		return ENOMEM;
-	}
+    result = as_sharedin(old);
+    if (result) {
+        lock_release(old->as_lock);
+        as_destroy(newas);
+        return result;
+    }
+
+    num = regionarray_num(&old->as_regions);
+    for (i = 0; i < num; ++i) {
+        rg = regionarray_get(&old->as_regions, i);
+        result = as_addregion(newas, rg->rg_base, rg->rg_npages, rg->rg_perms,
+                              &newrg);
+        if (result) {
+            lock_release(old->as_lock);
+            as_destroy(newas);
+            return result;
+        }
+        if (rg == old->as_heap) {
+            newas->as_heap = newrg;
+        }
+        newrg->rg_flags = rg->rg_flags;
+        newrg->rg_offset = rg->rg_offset;
+        newrg->rg_filesize = rg->rg_filesize;
+        newrg->rg_vnode = rg->rg_vnode;
+        if (newrg->rg_vnode != NULL) {
+            VOP_INCREF(newrg->rg_vnode);
+        }
+    }
+
+    ci.ci_newas = newas;
+    result = 0;
+    for (i = 0; i < num && result == 0; ++i) {
+        rg = regionarray_get(&old->as_regions, i);
+        ci.ci_writable = (rg->rg_perms & RG_WRITE) != 0;
+        ci.ci_shared = (rg->rg_flags & RGF_SHARED) != 0;
+        result = pt_foreach(old->as_pt, rg->rg_base,
+                            rg->rg_base + rg->rg_npages * PAGE_SIZE,
+                            as_sharepage, &ci);
+    }
+
+    /*
+     * The old address space's private pages are now read-only, even if we
+     * failed partway; drop any writable translations for them.
+     */
+    vm_shootdown(old, TLBSHOOTDOWN_ALL);
+
+    lock_release(old->as_lock);
+
+    if (result) {
+        as_destroy(newas);
+        return result;
+    }
+
+    *ret = newas;
+    return 0;
+}
+
+/*
+ * pt_foreach callback for as_destroy.
+ */
+static
+int
+as_freepage(vaddr_t va, pte_t *pte, void *data)
+{
+    (void)va;
+    (void)data;
+
+    if (*pte & PTE_SWAPPED) {
+        swap_free(PTE_SLOT(*pte));
+    }
+    else if ((*pte & PTE_PRESENT) && !(*pte & PTE_ZERO)) {
+        coremap_free_upage(*pte & PTE_FRAME);
+    }
+    *pte = 0;
+
+    return 0;
+}
+
+struct as_dropinfo {
+    struct addrspace *di_as;
+    struct vm_shootdownbatch di_sb;
+};
+
+/*
+ * pt_foreach callback for as_droppages: take away a present page's
+ * translations, leaving its frame in the PTE for as_droppage.
+ */
+static
+int
+as_unmappage(vaddr_t va, pte_t *pte, void *data)
+{
+    struct as_dropinfo *di = data;
+
+    if (*pte & PTE_PRESENT) {
+        *pte &= ~PTE_PRESENT;
+        vm_shootdown_add(&di->di_sb, di->di_as, va);
+    }
+    return 0;
+}
+
+/*
+ * pt_foreach callback for as_droppages: free a page as_unmappage has
+ * unmapped, or one in swap.
+ */
+static
+int
+as_droppage(vaddr_t va, pte_t *pte, void *data)
+{
+    if (!(*pte & PTE_SWAPPED)) {
+        *pte |= PTE_PRESENT;
+    }
+    return as_freepage(va, pte, data);
+}
+
+/*
+ * Unmap the pages in [START, END) and free them. Their translations
+ * have to go first, as the frames may be reused at once; they go in
+ * one batch, so each CPU is interrupted once however many pages there
+ * are. Call with as_lock held.
+ */
+static
+void
+as_droppages(struct addrspace *as, vaddr_t start, vaddr_t end)
+{
+    struct as_dropinfo di;
+
+    di.di_as = as;
+    vm_shootdown_begin(&di.di_sb);
+    pt_foreach(as->as_pt, start, end, as_unmappage, &di);
+    vm_shootdown_end(&di.di_sb);
+
+    pt_foreach(as->as_pt, start, end, as_droppage, NULL);
+}
+
+struct as_syncinfo {
+    struct addrspace *si_as;
+    struct region *si_rg;
+    off_t si_filesize;
+};
+
+/*
+ * pt_foreach callback for as_syncregion: write a changed page back to
+ * the file, leaving out any part past the end of the file.
+ */
+static
+int
+as_syncpage(vaddr_t va, pte_t *pte, void *data)
+{
+    struct as_syncinfo *si = data;
+    struct iovec iov;
+    struct uio u;
+    vaddr_t kva;
+    off_t offset;
+    size_t len;
+    int result;
+
+    if (!(*pte & PTE_DIRTY)) {
+        return 0;
+    }
+
+    offset = si->si_rg->rg_offset + (va - si->si_rg->rg_base);
+    len = PAGE_SIZE;
+    if (offset >= si->si_filesize) {
+        len = 0;
+    }
+    else if (si->si_filesize - offset < PAGE_SIZE) {
+        len = si->si_filesize - offset;
+    }
+
+    if (*pte & PTE_SWAPPED) {
+        /* Bring it into a kernel page just long enough to write it. */
+        kva = alloc_kpages(1);
+        if (kva == 0) {
+            return ENOMEM;
+        }
+        result = swap_read(PTE_SLOT(*pte), KVADDR_TO_PADDR(kva));
+        if (result) {
+            free_kpages(kva);
+            return result;
+        }
+    }
+    else {
+        /* Make it read-only, so a write after this marks it again. */
+        kva = PADDR_TO_KVADDR(*pte & PTE_FRAME);
+        if (*pte & PTE_WRITE) {
+            *pte &= ~PTE_WRITE;
+            vm_shootdown(si->si_as, va);
+        }
+    }
+
+    uio_kinit(&iov, &u, (void *)kva, len, offset, UIO_WRITE);
+    result = len == 0 ? 0 : VOP_WRITE(si->si_rg->rg_vnode, &u);
+    if (*pte & PTE_SWAPPED) {
+        free_kpages(kva);
+    }
+    if (result) {
+        return result;
+    }
+
+    *pte &= ~PTE_DIRTY;
+    return 0;
+}
+
+/*
+ * Write back the changed pages of shared mapping RG in [START, END).
+ * Call with as_lock held.
+ */
+static
+int
+as_syncregion(struct addrspace *as, struct region *rg, vaddr_t start,
+              vaddr_t end)
+{
+    struct as_syncinfo si;
+    struct stat st;
+    int result;
 
-	/*
-	 * Write this.
-	 */
+    if (!(rg->rg_flags & RGF_SHARED)) {
+        return 0;
+    }
 
-	(void)old;
+    result = VOP_STAT(rg->rg_vnode, &st);
+    if (result) {
+        return result;
+    }
 
-	*ret = newas;
-	return 0;
+    si.si_as = as;
+    si.si_rg = rg;
+    si.si_filesize = st.st_size;
+    return pt_foreach(as->as_pt, start, end, as_syncpage, &si);
 }
 
 void
 as_destroy(struct addrspace *as)
 {
-	/*
-	 * Clean up as needed.
-	 */
+    struct region *rg;
+    unsigned i;
+
+    /* Shared mappings get written back however the process goes away. */
+    lock_acquire(as->as_lock);
+    for (i = 0; i < regionarray_num(&as->as_regions); ++i) {
+        rg = regionarray_get(&as->as_regions, i);
+        as_syncregion(as, rg, rg->rg_base,
+                      rg->rg_base + rg->rg_npages * PAGE_SIZE);
+    }
+    lock_release(as->as_lock);
+
+    /* Pageout may be about to take as_lock; make sure it isn't. */
+    pageout_lock();
+    pt_foreach(as->as_pt, 0, USERSPACETOP, as_freepage, NULL);
+    pageout_unlock();
+    pt_destroy(as->as_pt);
+
+    while (regionarray_num(&as->as_regions) > 0) {
+        as_removeregion(as, regionarray_num(&as->as_regions) - 1);
+    }
+    regionarray_cleanup(&as->as_regions);
 
-	kfree(as);
+    vm_tlbforget(as);
+    lock_destroy(as->as_lock);
+    kfree(as);
 }
 
 void
 as_activate(void)
 {
-	struct addrspace *as;
+    struct addrspace *as;
 
-	as = proc_getas();
-	if (as == NULL) {
-		/*
-		 * Kernel thread without an address space; leave the
-		 * prior address space in place.
-		 */
-		return;
-	}
+    as = proc_getas();
+    if (as == NULL) {
+        /*
+         * Kernel thread without an address space; leave the
+         * prior address space in place.
+         */
+        return;
+    }
 
-	/*
-	 * Write this.
-	 */
+    /* Translations are tagged, so there's no need to flush the TLB. */
+    vm_tlbactivate(as);
 }
 
 void
 as_deactivate(void)
 {
-	/*
-	 * Write this. For many designs it won't need to actually do
-	 * anything. See proc.c for an explanation of why it (might)
-	 * be needed.
-	 */
+    /* Stop translating for the old address space before it goes away. */
+    vm_tlbactivate(NULL);
+}
+
+/*
+ * Add the region as_define_region and as_define_fileregion describe,
+ * with everything but the file filled in.
+ */
+static
+int
+as_defineregion(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+                int readable, int writeable, int executable,
+                struct region **ret)
+{
+    size_t npages;
+    int perms;
+
+    /* Align the region. First, the base... */
+    memsize += vaddr & ~(vaddr_t)PAGE_FRAME;
+    vaddr &= PAGE_FRAME;
+
+    /* ...and now the length. */
+    memsize = (memsize + PAGE_SIZE - 1) & PAGE_FRAME;
+    npages = memsize / PAGE_SIZE;
+
+    if (vaddr + memsize > USERSPACETOP || vaddr + memsize < vaddr) {
+        return EFAULT;
+    }
+
+    perms = (readable ? RG_READ : 0) | (writeable ? RG_WRITE : 0) |
+            (executable ? RG_EXEC : 0);
+
+    return as_addregion(as, vaddr, npages, perms, ret);
 }
 
 /*
@@ -122,61 +666,479 @@ as_deactivate(void)
  * VADDR+MEMSIZE.
  *
  * The READABLE, WRITEABLE, and EXECUTABLE flags are set if read,
- * write, or execute permission should be set on the segment. At the
- * moment, these are ignored. When you write the VM system, you may
- * want to implement them.
+ * write, or execute permission should be set on the segment. The
+ * hardware can't refuse reads or execution of a mapped page, so only
+ * WRITEABLE is enforced.
  */
 int
 as_define_region(struct addrspace *as, vaddr_t vaddr, size_t memsize,
-		 int readable, int writeable, int executable)
+                 int readable, int writeable, int executable)
 {
-	/*
-	 * Write this.
-	 */
+    int result;
+
+    lock_acquire(as->as_lock);
+    result = as_defineregion(as, vaddr, memsize, readable, writeable,
+                             executable, NULL);
+    lock_release(as->as_lock);
 
-	(void)as;
-	(void)vaddr;
-	(void)memsize;
-	(void)readable;
-	(void)writeable;
-	(void)executable;
-	return ENOSYS;
+    return result;
+}
+
+/*
+ * The region's pages come from VN privately: writes never reach the
+ * file. VADDR and OFFSET must be the same distance into a page, so
+ * that whole pages of the file line up with whole pages of memory.
+ */
+int
+as_define_fileregion(struct addrspace *as, vaddr_t vaddr, size_t memsize,
+                     struct vnode *vn, off_t offset, size_t filesize,
+                     int readable, int writeable, int executable)
+{
+    struct region *rg;
+    size_t pageoff;
+    int result;
+
+    pageoff = vaddr & ~(vaddr_t)PAGE_FRAME;
+    if (offset % PAGE_SIZE != (off_t)pageoff || filesize > memsize) {
+        return EINVAL;
+    }
+
+    lock_acquire(as->as_lock);
+    result = as_defineregion(as, vaddr, memsize, readable, writeable,
+                             executable, &rg);
+    if (result == 0) {
+        VOP_INCREF(vn);
+        rg->rg_vnode = vn;
+        rg->rg_offset = offset - pageoff;
+        rg->rg_filesize = pageoff + filesize;
+    }
+    lock_release(as->as_lock);
+
+    return result;
 }
 
 int
 as_prepare_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+    /* Nothing to allocate; just let load_elf write everywhere for now. */
+    lock_acquire(as->as_lock);
+    as->as_loading = true;
+    lock_release(as->as_lock);
+
+    return 0;
+}
+
+/*
+ * pt_foreach callback for as_complete_load.
+ */
+static
+int
+as_writeprotect(vaddr_t va, pte_t *pte, void *data)
+{
+    (void)va;
+    (void)data;
 
-	(void)as;
-	return 0;
+    *pte &= ~PTE_WRITE;
+    return 0;
 }
 
 int
 as_complete_load(struct addrspace *as)
 {
-	/*
-	 * Write this.
-	 */
+    struct region *rg;
+    vaddr_t heapbase;
+    unsigned i, num;
+    int result;
+
+    lock_acquire(as->as_lock);
+
+    /* The heap starts out empty, just past the last segment. */
+    num = regionarray_num(&as->as_regions);
+    heapbase = 0;
+    if (num > 0) {
+        rg = regionarray_get(&as->as_regions, num - 1);
+        heapbase = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+    }
+    result = as_addregion(as, heapbase, 0, RG_READ | RG_WRITE, &as->as_heap);
+    if (result) {
+        lock_release(as->as_lock);
+        return result;
+    }
 
-	(void)as;
-	return 0;
+    /* Take back write access to pages load_elf filled in read-only regions. */
+    for (i = 0; i < regionarray_num(&as->as_regions); ++i) {
+        rg = regionarray_get(&as->as_regions, i);
+        if (!(rg->rg_perms & RG_WRITE)) {
+            pt_foreach(as->as_pt, rg->rg_base,
+                       rg->rg_base + rg->rg_npages * PAGE_SIZE,
+                       as_writeprotect, NULL);
+        }
+    }
+    as->as_loading = false;
+
+    lock_release(as->as_lock);
+
+    /* Get rid of any writable translations left over from loading. */
+    vm_shootdown(as, TLBSHOOTDOWN_ALL);
+
+    return 0;
 }
 
 int
 as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 {
-	/*
-	 * Write this.
-	 */
+    int result;
 
-	(void)as;
+    lock_acquire(as->as_lock);
+    result = as_addregion(as, USERSTACK - VM_STACKPAGES * PAGE_SIZE,
+                          VM_STACKPAGES, RG_READ | RG_WRITE, NULL);
+    lock_release(as->as_lock);
+    if (result) {
+        return result;
+    }
 
-	/* Initial user-level stack pointer */
-	*stackptr = USERSTACK;
+    /* Initial user-level stack pointer */
+    *stackptr = USERSTACK;
 
-	return 0;
+    return 0;
 }
 
+/*
+ * The most pages a heap may have: the RAM and swap not in use right
+ * now. Pages the heap already has count as in use, which errs on the
+ * safe side.
+ */
+static
+size_t
+as_heaplimit(void)
+{
+    unsigned used;
+
+    used = coremap_used_bytes() / PAGE_SIZE + swap_used();
+    return coremap_npages() + swap_npages() - used;
+}
+
+int
+as_sbrk(struct addrspace *as, intptr_t amount, vaddr_t *oldbreak)
+{
+    struct region *rg, *next;
+    vaddr_t end, newend;
+    unsigned pos;
+    intptr_t npages;
+
+    if (amount % PAGE_SIZE != 0) {
+        return EINVAL;
+    }
+    npages = amount / PAGE_SIZE;
+
+    lock_acquire(as->as_lock);
+
+    rg = as->as_heap;
+    if (rg == NULL) {
+        lock_release(as->as_lock);
+        return ENOMEM;
+    }
+    end = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+
+    if (npages < 0) {
+        if ((size_t)-npages > rg->rg_npages) {
+            lock_release(as->as_lock);
+            return EINVAL;
+        }
+        newend = end + npages * PAGE_SIZE;
+
+        /* Give the memory back now rather than when we exit. */
+        as_droppages(as, newend, end);
+    }
+    else if (npages > 0) {
+        newend = end + npages * PAGE_SIZE;
+
+        /* Don't run into whatever comes next (normally the stack). */
+        pos = as_searchregion(as, end);
+        next = pos < regionarray_num(&as->as_regions) ?
+            regionarray_get(&as->as_regions, pos) : NULL;
+        if (newend < end || newend > USERSPACETOP ||
+            (next != NULL && newend > next->rg_base)) {
+            lock_release(as->as_lock);
+            return ENOMEM;
+        }
+
+        /* Or past what RAM and swap could actually hold. */
+        if (rg->rg_npages + (size_t)npages > as_heaplimit()) {
+            lock_release(as->as_lock);
+            return ENOMEM;
+        }
+
+        /* Nothing to allocate; the pages get filled in as they're touched. */
+    }
+    else {
+        newend = end;
+    }
+    rg->rg_npages = (newend - rg->rg_base) / PAGE_SIZE;
+
+    lock_release(as->as_lock);
+
+    *oldbreak = end;
+    return 0;
+}
+
+/*
+ * Find room for NPAGES pages, as high up as possible so the heap has
+ * space to grow. Call with as_lock held.
+ */
+static
+int
+as_findgap(struct addrspace *as, size_t npages, vaddr_t *ret)
+{
+    struct region *rg;
+    vaddr_t lo, hi;
+    size_t size;
+    unsigned i;
+
+    size = npages * PAGE_SIZE;
+    hi = USERSPACETOP;
+    for (i = regionarray_num(&as->as_regions); ; --i) {
+        if (i > 0) {
+            rg = regionarray_get(&as->as_regions, i - 1);
+            lo = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+        }
+        else {
+            /* Keep page 0 unmapped, to catch null pointers. */
+            lo = PAGE_SIZE;
+        }
+        if (hi >= lo && hi - lo >= size) {
+            *ret = hi - size;
+            return 0;
+        }
+        if (i == 0) {
+            return ENOMEM;
+        }
+        hi = rg->rg_base;
+    }
+}
+
+int
+as_mmap(struct addrspace *as, vaddr_t *addr, size_t len, int prot, int flags,
+        struct vnode *vn, off_t offset)
+{
+    struct region *rg;
+    vaddr_t base;
+    size_t npages;
+    int perms;
+    int result;
+
+    if (len == 0 || offset % PAGE_SIZE != 0 || offset < 0) {
+        return EINVAL;
+    }
+    if (len > USERSPACETOP) {
+        return ENOMEM;
+    }
+    npages = (len + PAGE_SIZE - 1) / PAGE_SIZE;
+
+    perms = ((prot & PROT_READ) ? RG_READ : 0) |
+            ((prot & PROT_WRITE) ? RG_WRITE : 0) |
+            ((prot & PROT_EXEC) ? RG_EXEC : 0);
+
+    lock_acquire(as->as_lock);
+
+    if (flags & MAP_FIXED) {
+        base = *addr;
+        if (base % PAGE_SIZE != 0 || base == 0 ||
+            base + npages * PAGE_SIZE > USERSPACETOP ||
+            base + npages * PAGE_SIZE < base) {
+            lock_release(as->as_lock);
+            return EINVAL;
+        }
+    }
+    else {
+        result = as_findgap(as, npages, &base);
+        if (result) {
+            lock_release(as->as_lock);
+            return result;
+        }
+    }
+
+    result = as_addregion(as, base, npages, perms, &rg);
+    if (result) {
+        lock_release(as->as_lock);
+        return result;
+    }
+    rg->rg_flags = RGF_MMAP;
+    if (vn != NULL) {
+        VOP_INCREF(vn);
+        rg->rg_vnode = vn;
+        rg->rg_offset = offset;
+        rg->rg_filesize = npages * PAGE_SIZE;
+        if (flags & MAP_SHARED) {
+            rg->rg_flags |= RGF_SHARED;
+        }
+    }
+
+    lock_release(as->as_lock);
+
+    *addr = base;
+    return 0;
+}
+
+/*
+ * How many bytes of RG from VA on come from its file.
+ */
+static
+size_t
+as_filerest(struct region *rg, vaddr_t va)
+{
+    size_t skip = va - rg->rg_base;
+
+    return rg->rg_filesize > skip ? rg->rg_filesize - skip : 0;
+}
+
+/*
+ * Check that [START, END) is page-aligned and in user space.
+ */
+static
+int
+as_checkrange(vaddr_t start, size_t len, vaddr_t *end)
+{
+    if (start % PAGE_SIZE != 0) {
+        return EINVAL;
+    }
+    *end = start + ((len + PAGE_SIZE - 1) & PAGE_FRAME);
+    if (*end < start || *end > USERSPACETOP) {
+        return EINVAL;
+    }
+    return 0;
+}
+
+int
+as_munmap(struct addrspace *as, vaddr_t addr, size_t len)
+{
+    struct region *rg, *tail;
+    vaddr_t end, rgend, s, e;
+    unsigned pos;
+    int result;
+
+    result = as_checkrange(addr, len, &end);
+    if (result) {
+        return result;
+    }
+
+    lock_acquire(as->as_lock);
+
+    /* Only mmap's own regions can be unmapped. */
+    for (pos = as_searchregion(as, addr);
+         pos < regionarray_num(&as->as_regions); ++pos) {
+        rg = regionarray_get(&as->as_regions, pos);
+        if (rg->rg_base >= end) {
+            break;
+        }
+        if (!(rg->rg_flags & RGF_MMAP)) {
+            lock_release(as->as_lock);
+            return EINVAL;
+        }
+    }
+
+    pos = as_searchregion(as, addr);
+    while (pos < regionarray_num(&as->as_regions)) {
+        rg = regionarray_get(&as->as_regions, pos);
+        if (rg->rg_base >= end) {
+            break;
+        }
+        rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+        s = addr > rg->rg_base ? addr : rg->rg_base;
+        e = end < rgend ? end : rgend;
+
+        /* Unmapping the middle splits the region; do that first. */
+        if (s > rg->rg_base && e < rgend) {
+            rg->rg_npages = (e - rg->rg_base) / PAGE_SIZE;
+            result = as_addregion(as, e, (rgend - e) / PAGE_SIZE,
+                                  rg->rg_perms, &tail);
+            if (result) {
+                rg->rg_npages = (rgend - rg->rg_base) / PAGE_SIZE;
+                lock_release(as->as_lock);
+                return result;
+            }
+            tail->rg_flags = rg->rg_flags;
+            tail->rg_vnode = rg->rg_vnode;
+            tail->rg_offset = rg->rg_offset + (e - rg->rg_base);
+            tail->rg_filesize = as_filerest(rg, e);
+            if (tail->rg_vnode != NULL) {
+                VOP_INCREF(tail->rg_vnode);
+            }
+        }
+
+        result = as_syncregion(as, rg, s, e);
+        if (result) {
+            lock_release(as->as_lock);
+            return result;
+        }
+        as_droppages(as, s, e);
+
+        if (s == rg->rg_base && e == rgend) {
+            as_removeregion(as, pos);
+            continue;
+        }
+        if (s == rg->rg_base) {
+            rg->rg_offset += e - rg->rg_base;
+            rg->rg_filesize = as_filerest(rg, e);
+            rg->rg_base = e;
+            rg->rg_npages = (rgend - e) / PAGE_SIZE;
+        }
+        else {
+            /* The end, or the head left by a split. */
+            rg->rg_npages = (s - rg->rg_base) / PAGE_SIZE;
+        }
+        pos++;
+    }
+
+    lock_release(as->as_lock);
+    return 0;
+}
+
+int
+as_msync(struct addrspace *as, vaddr_t addr, size_t len)
+{
+    struct region *rg;
+    vaddr_t end, rgend, next;
+    unsigned pos;
+    int result;
+
+    result = as_checkrange(addr, len, &end);
+    if (result) {
+        return result;
+    }
+
+    lock_acquire(as->as_lock);
+
+    /* All of the range has to be mapped. */
+    next = addr;
+    for (pos = as_searchregion(as, addr);
+         pos < regionarray_num(&as->as_regions) && next < end; ++pos) {
+        rg = regionarray_get(&as->as_regions, pos);
+        if (rg->rg_base > next) {
+            break;
+        }
+        next = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+    }
+    if (next < end) {
+        lock_release(as->as_lock);
+        return ENOMEM;
+    }
+
+    for (pos = as_searchregion(as, addr);
+         pos < regionarray_num(&as->as_regions); ++pos) {
+        rg = regionarray_get(&as->as_regions, pos);
+        if (rg->rg_base >= end) {
+            break;
+        }
+        rgend = rg->rg_base + rg->rg_npages * PAGE_SIZE;
+        result = as_syncregion(as, rg, addr > rg->rg_base ? addr : rg->rg_base,
+                               end < rgend ? end : rgend);
+        if (result) {
+            lock_release(as->as_lock);
+            return result;
+        }
+    }
+
+    lock_release(as->as_lock);
+    return 0;
+}
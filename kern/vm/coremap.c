@@ -0,0 +1,746 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <current.h>
+#include <platform/maxcpus.h>
+#include <thread.h>
+#include <synch.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <vmprivate.h>
+
+/*
+ * Physical page allocator.
+ *
+ * The coremap itself is taken from the start of free memory the first
+ * time a page is asked for, which happens very early in boot (long
+ * before vm_bootstrap), while there is still only one thread.
+ *
+ * Fields of a user page that has an owner (cm_va, cm_slot) only change
+ * with the owner's as_lock held; the spinlock covers everything else.
+ *
+ * Idle CPUs zero free pages into a pool of their own, for faults that
+ * need a zero-filled page (coremap_alloc_zeroed_upage). Pooled pages
+ * still count as free: when free pages run short they go back to the
+ * free list.
+ *
+ * When a multi-page kernel allocation finds enough free pages but no
+ * run of them, compaction moves user pages out of the way: it picks
+ * the window of pages that needs the fewest moved, and copies each
+ * user page with a single owner somewhere else, fixing up its PTE. It
+ * only ever tries for locks (pageout's, then the owner's as_lock), so
+ * it is safe however the allocating thread got here, but it gives up
+ * on pages it can't lock and may come up short.
+ */
+
+/* Pre-zeroed pages, per CPU. */
+struct cm_zpool {
+    unsigned zp_pages[CM_ZPOOLPAGES];   /* Coremap indexes. */
+    unsigned zp_npages;
+    unsigned zp_hits;                   /* Zeroed page wanted and here. */
+    unsigned zp_misses;                 /* ...and not. */
+    unsigned zp_zeroed;                 /* Pages zeroed while idle. */
+};
+
+static struct cm_entry *coremap;
+static unsigned cm_npages;          /* Pages of RAM, and coremap entries. */
+static unsigned cm_firstpage;       /* First page we manage. */
+static unsigned cm_nfree;           /* Free pages. */
+static unsigned cm_nused;           /* Pages allocated (kernel or user). */
+static unsigned cm_hand;            /* Clock hand for page replacement. */
+static unsigned cm_npooled;         /* Pages in the zero pools. */
+static struct cm_zpool cm_zpools[MAXCPUS];
+static unsigned cm_compactions;     /* Times compaction was tried. */
+static unsigned cm_compacted;       /* ...and got its run. */
+static unsigned cm_migrated;        /* User pages it moved. */
+static struct spinlock coremap_lock = SPINLOCK_INITIALIZER;
+
+#define PA_TO_INDEX(pa)     ((pa) / PAGE_SIZE)
+#define INDEX_TO_PA(i)      ((paddr_t)(i) * PAGE_SIZE)
+
+void
+coremap_bootstrap(void)
+{
+    paddr_t lastpaddr, firstfree;
+    size_t cmsize;
+
+    if (coremap != NULL) {
+        return;
+    }
+
+    lastpaddr = ram_getsize();
+    cm_npages = lastpaddr / PAGE_SIZE;
+
+    cmsize = ROUNDUP(cm_npages * sizeof(struct cm_entry), PAGE_SIZE);
+    firstfree = ram_stealmem(cmsize / PAGE_SIZE);
+    if (firstfree == 0) {
+        panic("coremap: no room for the coremap\n");
+    }
+    coremap = (struct cm_entry *)PADDR_TO_KVADDR(firstfree);
+
+    /* Everything below here is the kernel, the coremap or already stolen. */
+    firstfree = ram_getfirstfree();
+    cm_firstpage = PA_TO_INDEX(firstfree);
+    KASSERT(cm_firstpage < cm_npages);
+
+    for (unsigned i = 0; i < cm_npages; ++i) {
+        coremap[i].cm_as = NULL;
+        coremap[i].cm_va = 0;
+        coremap[i].cm_npages = 0;
+        coremap[i].cm_slot = 0;
+        coremap[i].cm_refcount = 0;
+        coremap[i].cm_state = i < cm_firstpage ? CM_FIXED : CM_FREE;
+        coremap[i].cm_flags = 0;
+    }
+    cm_nfree = cm_npages - cm_firstpage;
+    cm_nused = 0;
+    cm_hand = cm_firstpage;
+}
+
+/*
+ * Put pooled pages back on the free list until there are at least
+ * WANT free pages, or no pooled ones left.
+ */
+static
+void
+coremap_unpool(unsigned want)
+{
+    struct cm_zpool *zp;
+    unsigned i;
+
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+    for (unsigned c = 0; c < MAXCPUS && cm_nfree < want; ++c) {
+        zp = &cm_zpools[c];
+        while (zp->zp_npages > 0 && cm_nfree < want) {
+            i = zp->zp_pages[--zp->zp_npages];
+            KASSERT(coremap[i].cm_state == CM_ZERO);
+            coremap[i].cm_state = CM_FREE;
+            cm_npooled--;
+            cm_nfree++;
+        }
+    }
+}
+
+/*
+ * Find a free page for a user page, or for the zero pool. These come
+ * from the top of memory.
+ */
+static
+unsigned
+coremap_findfree(void)
+{
+    unsigned i;
+
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+    KASSERT(cm_nfree > 0);
+
+    for (i = cm_npages - 1; i >= cm_firstpage; --i) {
+        if (coremap[i].cm_state == CM_FREE) {
+            break;
+        }
+    }
+    KASSERT(i >= cm_firstpage);
+    return i;
+}
+
+/*
+ * Make page I a user page of AS at VA.
+ */
+static
+void
+coremap_setuser(unsigned i, struct addrspace *as, vaddr_t va)
+{
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+    coremap[i].cm_state = CM_USER;
+    coremap[i].cm_refcount = 1;
+    coremap[i].cm_as = as;
+    coremap[i].cm_va = va;
+    coremap[i].cm_slot = 0;
+    coremap[i].cm_flags = CMF_REFERENCED;
+    cm_nused++;
+    vm_count(VMS_PAGEALLOCS);
+}
+
+/*
+ * Find NPAGES free pages in a row, lowest first. Returns the index of
+ * the first one, or 0 (which is never free) if there aren't any.
+ */
+static
+unsigned
+coremap_findrun(unsigned npages)
+{
+    unsigned run = 0;
+
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+    for (unsigned i = cm_firstpage; i < cm_npages; ++i) {
+        if (coremap[i].cm_state != CM_FREE) {
+            run = 0;
+            continue;
+        }
+        if (++run == npages) {
+            return i + 1 - npages;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Whether page I is a user page compaction may move: one owner, and
+ * so exactly one PTE pointing at it.
+ */
+static
+bool
+coremap_movable(unsigned i)
+{
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+    return coremap[i].cm_state == CM_USER && coremap[i].cm_as != NULL &&
+        coremap[i].cm_refcount == 1;
+}
+
+/*
+ * Find the run of NPAGES pages, all free or movable, with the fewest
+ * movable ones. Returns its first page, or 0 if there's no such run.
+ */
+static
+unsigned
+coremap_findwindow(unsigned npages)
+{
+    unsigned run, moves, best, bestmoves;
+
+    KASSERT(spinlock_do_i_hold(&coremap_lock));
+
+    run = moves = best = 0;
+    bestmoves = npages + 1;
+    for (unsigned i = cm_firstpage; i < cm_npages; ++i) {
+        if (coremap_movable(i)) {
+            moves++;
+        }
+        else if (coremap[i].cm_state != CM_FREE) {
+            run = moves = 0;
+            continue;
+        }
+        if (++run > npages) {
+            run--;
+            if (coremap_movable(i - npages)) {
+                moves--;
+            }
+        }
+        if (run == npages && moves < bestmoves) {
+            best = i + 1 - npages;
+            bestmoves = moves;
+        }
+    }
+    return best;
+}
+
+/*
+ * Move user page I somewhere outside [LO, HI). Returns false if the
+ * page couldn't be moved.
+ */
+static
+bool
+coremap_migrate(unsigned i, unsigned lo, unsigned hi)
+{
+    struct addrspace *as;
+    vaddr_t va;
+    pte_t *pte, old;
+    unsigned j;
+
+    spinlock_acquire(&coremap_lock);
+    if (!coremap_movable(i)) {
+        spinlock_release(&coremap_lock);
+        return false;
+    }
+    as = coremap[i].cm_as;
+    va = coremap[i].cm_va;
+    spinlock_release(&coremap_lock);
+
+    /* Our caller may be in the middle of changing this one. */
+    if (lock_do_i_hold(as->as_lock) || !lock_tryacquire(as->as_lock)) {
+        return false;
+    }
+
+    /* Skip pages not mapped yet, e.g. vm_fault's spares. */
+    pte = pt_get(as->as_pt, va, false);
+    if (pte == NULL || !(*pte & PTE_PRESENT) || (*pte & PTE_ZERO) ||
+        (*pte & PTE_FRAME) != INDEX_TO_PA(i)) {
+        lock_release(as->as_lock);
+        return false;
+    }
+
+    spinlock_acquire(&coremap_lock);
+    if (!coremap_movable(i) || coremap[i].cm_as != as) {
+        spinlock_release(&coremap_lock);
+        lock_release(as->as_lock);
+        return false;
+    }
+    for (j = cm_npages - 1; j >= hi; --j) {
+        if (coremap[j].cm_state == CM_FREE) {
+            break;
+        }
+    }
+    if (j < hi) {
+        for (j = lo - 1; j >= cm_firstpage; --j) {
+            if (coremap[j].cm_state == CM_FREE) {
+                break;
+            }
+        }
+        if (j < cm_firstpage) {
+            spinlock_release(&coremap_lock);
+            lock_release(as->as_lock);
+            return false;
+        }
+    }
+    coremap[j] = coremap[i];
+    cm_nfree--;
+    spinlock_release(&coremap_lock);
+
+    /* Faults block on as_lock while the page is unmapped. */
+    old = *pte;
+    *pte = old & ~PTE_PRESENT;
+    vm_shootdown(as, va);
+    memcpy((void *)PADDR_TO_KVADDR(INDEX_TO_PA(j)),
+           (const void *)PADDR_TO_KVADDR(INDEX_TO_PA(i)), PAGE_SIZE);
+    *pte = INDEX_TO_PA(j) | (old & ~PTE_FRAME);
+
+    /* The new page took over the swap slot, if any. */
+    spinlock_acquire(&coremap_lock);
+    coremap[i].cm_state = CM_FREE;
+    coremap[i].cm_as = NULL;
+    coremap[i].cm_va = 0;
+    coremap[i].cm_slot = 0;
+    coremap[i].cm_refcount = 0;
+    coremap[i].cm_flags = 0;
+    cm_nfree++;
+    cm_migrated++;
+    spinlock_release(&coremap_lock);
+
+    lock_release(as->as_lock);
+    return true;
+}
+
+/*
+ * Try to make a run of NPAGES free pages by moving user pages out of
+ * the way. The caller has checked there are enough free pages.
+ */
+static
+void
+coremap_compact(unsigned npages)
+{
+    unsigned first;
+
+    /* Moving pages takes locks and TLB shootdowns, which need spl 0. */
+    if (curthread->t_in_interrupt || curcpu->c_spinlocks > 0 ||
+        curthread->t_curspl > 0) {
+        return;
+    }
+    if (!pageout_trylock()) {
+        return;
+    }
+
+    spinlock_acquire(&coremap_lock);
+    cm_compactions++;
+    /* Pooled pages would be in the way. */
+    coremap_unpool(cm_npages);
+    first = coremap_findwindow(npages);
+    spinlock_release(&coremap_lock);
+
+    if (first != 0) {
+        for (unsigned i = first; i < first + npages; ++i) {
+            if (coremap[i].cm_state == CM_USER &&
+                !coremap_migrate(i, first, first + npages)) {
+                break;
+            }
+        }
+    }
+
+    pageout_unlock();
+}
+
+vaddr_t
+alloc_kpages(unsigned npages)
+{
+    unsigned first;
+    bool compacted = false;
+
+    KASSERT(npages > 0);
+
+    /* The first call comes early in boot, before there are other threads. */
+    if (coremap == NULL) {
+        coremap_bootstrap();
+    }
+
+    if (npages > 0xffff) {
+        return 0;
+    }
+
+    spinlock_acquire(&coremap_lock);
+ again:
+    coremap_unpool(npages);
+    if (npages > cm_nfree) {
+        spinlock_release(&coremap_lock);
+        return 0;
+    }
+    first = coremap_findrun(npages);
+    if (first == 0) {
+        if (npages == 1 || compacted) {
+            spinlock_release(&coremap_lock);
+            return 0;
+        }
+        spinlock_release(&coremap_lock);
+        coremap_compact(npages);
+        compacted = true;
+        spinlock_acquire(&coremap_lock);
+        goto again;
+    }
+    if (compacted) {
+        cm_compacted++;
+    }
+    for (unsigned i = first; i < first + npages; ++i) {
+        coremap[i].cm_state = CM_KERNEL;
+        coremap[i].cm_npages = 0;
+    }
+    coremap[first].cm_npages = npages;
+    cm_nfree -= npages;
+    cm_nused += npages;
+    spinlock_release(&coremap_lock);
+
+    pageout_wakeup();
+
+    return PADDR_TO_KVADDR(INDEX_TO_PA(first));
+}
+
+void
+free_kpages(vaddr_t addr)
+{
+    unsigned first, npages;
+
+    KASSERT(addr % PAGE_SIZE == 0);
+    first = PA_TO_INDEX(KVADDR_TO_PADDR(addr));
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(first < cm_npages);
+    KASSERT(coremap[first].cm_state == CM_KERNEL);
+    npages = coremap[first].cm_npages;
+    KASSERT(npages > 0);
+
+    for (unsigned i = first; i < first + npages; ++i) {
+        KASSERT(coremap[i].cm_state == CM_KERNEL);
+        coremap[i].cm_state = CM_FREE;
+        coremap[i].cm_npages = 0;
+    }
+    cm_nfree += npages;
+    cm_nused -= npages;
+    spinlock_release(&coremap_lock);
+}
+
+/*
+ * Take a free page for a user page, as long as that leaves at least
+ * RESERVE free pages.
+ */
+static
+paddr_t
+coremap_tryalloc_upage(struct addrspace *as, vaddr_t va, unsigned reserve)
+{
+    unsigned i;
+
+    spinlock_acquire(&coremap_lock);
+    coremap_unpool(reserve + 1);
+    if (cm_nfree <= reserve) {
+        spinlock_release(&coremap_lock);
+        return 0;
+    }
+
+    i = coremap_findfree();
+    coremap_setuser(i, as, va);
+    cm_nfree--;
+    spinlock_release(&coremap_lock);
+
+    return INDEX_TO_PA(i);
+}
+
+paddr_t
+coremap_alloc_upage(struct addrspace *as, vaddr_t va)
+{
+    paddr_t pa;
+
+    KASSERT(as != NULL);
+    KASSERT(va % PAGE_SIZE == 0);
+
+    while (1) {
+        pa = coremap_tryalloc_upage(as, va, PAGEOUT_RESERVE);
+        if (pa != 0) {
+            pageout_wakeup();
+            return pa;
+        }
+        if (pageout_reclaim() == 0) {
+            break;
+        }
+    }
+
+    /* Nothing left to page out; better the reserve than failing. */
+    return coremap_tryalloc_upage(as, va, 0);
+}
+
+paddr_t
+coremap_alloc_zeroed_upage(struct addrspace *as, vaddr_t va)
+{
+    struct cm_zpool *zp;
+    paddr_t pa;
+    unsigned i;
+
+    KASSERT(as != NULL);
+    KASSERT(va % PAGE_SIZE == 0);
+
+    spinlock_acquire(&coremap_lock);
+    zp = &cm_zpools[curcpu->c_number];
+    if (zp->zp_npages > 0) {
+        i = zp->zp_pages[--zp->zp_npages];
+        KASSERT(coremap[i].cm_state == CM_ZERO);
+        coremap_setuser(i, as, va);
+        cm_npooled--;
+        zp->zp_hits++;
+        spinlock_release(&coremap_lock);
+        pageout_wakeup();
+        return INDEX_TO_PA(i);
+    }
+    zp->zp_misses++;
+    spinlock_release(&coremap_lock);
+
+    pa = coremap_alloc_upage(as, va);
+    if (pa != 0) {
+        bzero((void *)PADDR_TO_KVADDR(pa), PAGE_SIZE);
+    }
+    return pa;
+}
+
+bool
+coremap_zeroidle(void)
+{
+    struct cm_zpool *zp;
+    unsigned i;
+
+    if (coremap == NULL) {
+        return false;
+    }
+
+    /* Only while there's memory to spare; pageout would want it back. */
+    spinlock_acquire(&coremap_lock);
+    zp = &cm_zpools[curcpu->c_number];
+    if (zp->zp_npages >= CM_ZPOOLPAGES || cm_nfree <= PAGEOUT_HIWATER) {
+        spinlock_release(&coremap_lock);
+        return false;
+    }
+    i = coremap_findfree();
+    coremap[i].cm_state = CM_ZERO;
+    cm_nfree--;
+    spinlock_release(&coremap_lock);
+
+    bzero((void *)PADDR_TO_KVADDR(INDEX_TO_PA(i)), PAGE_SIZE);
+
+    /* Only this CPU adds to its pool, so there's still room. */
+    spinlock_acquire(&coremap_lock);
+    KASSERT(zp->zp_npages < CM_ZPOOLPAGES);
+    zp->zp_pages[zp->zp_npages++] = i;
+    zp->zp_zeroed++;
+    cm_npooled++;
+    spinlock_release(&coremap_lock);
+
+    return true;
+}
+
+void
+coremap_printzpoolstats(void)
+{
+    struct cm_zpool *zp;
+
+    kprintf("Pre-zeroed page pools:\n");
+    kprintf("cpu  pooled   zeroed     hits   misses\n");
+    for (unsigned c = 0; c < num_cpus; ++c) {
+        zp = &cm_zpools[c];
+        kprintf("%3u %7u %8u %8u %8u\n", c, zp->zp_npages, zp->zp_zeroed,
+                zp->zp_hits, zp->zp_misses);
+    }
+}
+
+void
+coremap_printcompactstats(void)
+{
+    kprintf("Compaction: %u of %u tries got their run, %u pages moved\n",
+            cm_compacted, cm_compactions, cm_migrated);
+}
+
+void
+coremap_share(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    KASSERT(coremap[i].cm_refcount < 0xffff);
+    coremap[i].cm_refcount++;
+    coremap[i].cm_as = NULL;
+    spinlock_release(&coremap_lock);
+}
+
+void
+coremap_claim(paddr_t pa, struct addrspace *as, vaddr_t va)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    KASSERT(coremap[i].cm_refcount == 1);
+    coremap[i].cm_as = as;
+    coremap[i].cm_va = va;
+    spinlock_release(&coremap_lock);
+}
+
+unsigned
+coremap_refcount(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    return coremap[i].cm_refcount;
+}
+
+void
+coremap_touch(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    /* Just a hint for the clock; no need to lock. */
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    coremap[i].cm_flags |= CMF_REFERENCED;
+}
+
+unsigned
+coremap_getslot(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    return coremap[i].cm_slot;
+}
+
+void
+coremap_setslot(paddr_t pa, unsigned slot)
+{
+    unsigned i = PA_TO_INDEX(pa);
+
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    coremap[i].cm_slot = slot;
+}
+
+unsigned
+coremap_takeslot(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+    unsigned slot;
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    slot = coremap[i].cm_slot;
+    coremap[i].cm_slot = 0;
+    spinlock_release(&coremap_lock);
+
+    return slot;
+}
+
+unsigned
+coremap_npages(void)
+{
+    return cm_npages - cm_firstpage;
+}
+
+unsigned
+coremap_freepages(void)
+{
+    /* Unlocked read, like coremap_used_bytes. */
+    return cm_nfree + cm_npooled;
+}
+
+bool
+coremap_nextvictim(struct addrspace **as, vaddr_t *va, paddr_t *pa)
+{
+    struct cm_entry *cme;
+
+    spinlock_acquire(&coremap_lock);
+
+    /* Two trips round: the first may only clear referenced bits. */
+    for (unsigned n = 0; n < 2 * (cm_npages - cm_firstpage); ++n) {
+        if (++cm_hand >= cm_npages) {
+            cm_hand = cm_firstpage;
+        }
+        cme = &coremap[cm_hand];
+        if (cme->cm_state != CM_USER || cme->cm_as == NULL) {
+            continue;
+        }
+        if (cme->cm_flags & CMF_REFERENCED) {
+            cme->cm_flags &= ~CMF_REFERENCED;
+            continue;
+        }
+        *as = cme->cm_as;
+        *va = cme->cm_va;
+        *pa = INDEX_TO_PA(cm_hand);
+        spinlock_release(&coremap_lock);
+        return true;
+    }
+
+    spinlock_release(&coremap_lock);
+    return false;
+}
+
+void
+coremap_free_upage(paddr_t pa)
+{
+    unsigned i = PA_TO_INDEX(pa);
+    unsigned slot;
+
+    KASSERT(pa % PAGE_SIZE == 0);
+
+    spinlock_acquire(&coremap_lock);
+    KASSERT(i >= cm_firstpage && i < cm_npages);
+    KASSERT(coremap[i].cm_state == CM_USER);
+    KASSERT(coremap[i].cm_refcount > 0);
+    if (--coremap[i].cm_refcount > 0) {
+        /* Still mapped copy-on-write somewhere else. */
+        spinlock_release(&coremap_lock);
+        return;
+    }
+    slot = coremap[i].cm_slot;
+    coremap[i].cm_state = CM_FREE;
+    coremap[i].cm_as = NULL;
+    coremap[i].cm_va = 0;
+    coremap[i].cm_slot = 0;
+    cm_nfree++;
+    cm_nused--;
+    spinlock_release(&coremap_lock);
+    vm_count(VMS_PAGEFREES);
+
+    if (slot != 0) {
+        swap_free(slot);
+    }
+}
+
+unsigned
+int
+coremap_used_bytes(void)
+{
+    /* Unlocked read; it was right at some point. */
+    return cm_nused * PAGE_SIZE;
+}
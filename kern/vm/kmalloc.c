@@ -78,7 +78,8 @@ fill_deadbeef(void *vptr, size_t len)
 //    The free counts and addresses of the pages are maintained in
 //    another list.  Maintaining this table is a nuisance, because it
 //    cannot recursively use the subpage allocator. (We could probably
-//    make that work, but it would be painful.)
+//    make that work, but it would be painful.) Instead the pagerefs
+//    are carved out of whole pages, allocated as needed.
 //
 
 ////////////////////////////////////////
@@ -104,6 +105,12 @@ fill_deadbeef(void *vptr, size_t len)
  * LABELS records the allocation site and a generation number for each
  * allocation and is useful for tracking down memory leaks.
  *
+ * PROFILE enables LABELS and also records the requested size of each
+ * allocation, and keeps track of whole-page allocations as well. The
+ * khprof menu command then summarizes the live heap by call site and
+ * by request size, which shows how much is lost to rounding requests
+ * up to the block sizes below.
+ *
  * On top of these one can enable the following:
  *
  * CHECKBEEF checks that free blocks still contain 0xdeadbeef when
@@ -119,6 +126,7 @@ fill_deadbeef(void *vptr, size_t len)
 #undef SLOWER
 #undef GUARDS
 #undef LABELS
+#undef PROFILE
 
 #undef CHECKBEEF
 #undef CHECKGUARDS
@@ -147,7 +155,9 @@ struct freelist {
 
 struct pageref {
 	struct pageref *next_samesize;
+	struct pageref **prev_samesize;	/* pointer to us in the previous */
 	struct pageref *next_all;
+	struct pageref **prev_all;	/* ditto */
 	vaddr_t pageaddr_and_blocktype;
 	uint16_t freelist_offset;
 	uint16_t nfree;
@@ -176,8 +186,8 @@ static struct spinlock kmalloc_spinlock = SPINLOCK_INITIALIZER;
  * We can only allocate whole pages of pageref structure at a time.
  * This is a struct type for such a page.
  *
- * Each pageref page contains 256 pagerefs, which can manage up to
- * 256 * 4K = 1M of kernel heap.
+ * Each pageref page contains 170 pagerefs, which can manage up to
+ * 170 * 4K = 680K of kernel heap.
  */
 
 #define NPAGEREFS_PER_PAGE (PAGE_SIZE / sizeof(struct pageref))
@@ -187,48 +197,32 @@ struct pagerefpage {
 };
 
 /*
- * This structure holds a pointer to a pageref page and also its
- * bitmap of free entries.
- */
-
-#define INUSE_WORDS (NPAGEREFS_PER_PAGE / 32)
-
-struct kheap_root {
-	struct pagerefpage *page;
-	uint32_t pagerefs_inuse[INUSE_WORDS];
-	unsigned numinuse;
-};
-
-/*
- * It would be better to make this dynamically sizeable. However,
- * since we only actually run on System/161 and System/161 is
- * specifically limited to 16M of RAM, we'll just adopt that as a
- * static size limit.
- *
- * FUTURE: it would be better to pick this number based on the RAM
- * size we find at boot time.
+ * Free pagerefs are kept on a list, linked through next_all. When the
+ * list runs dry we get another page of them, so the number of heap
+ * pages we can manage is limited only by memory. Pageref pages are
+ * not given back once allocated.
  */
 
-#define NUM_PAGEREFPAGES 16
-#define TOTAL_PAGEREFS (NUM_PAGEREFPAGES * NPAGEREFS_PER_PAGE)
-
-static struct kheap_root kheaproots[NUM_PAGEREFPAGES];
+static struct pageref *freepagerefs;
+static unsigned numpagerefs;	/* total pagerefs ever allocated */
 
 /*
- * Allocate a page to hold pagerefs.
+ * Allocate a page to hold pagerefs and put them all on the free list.
  */
 static
 void
-allocpagerefpage(struct kheap_root *root)
+allocpagerefpage(void)
 {
+	struct pagerefpage *page;
 	vaddr_t va;
-
-	KASSERT(root->page == NULL);
+	unsigned i;
 
 	/*
 	 * We release the spinlock while calling alloc_kpages. This
 	 * avoids deadlock if alloc_kpages needs to come back here.
 	 * Note that this means things can change behind our back...
+	 * in particular somebody else might also refill the free
+	 * list, but that does no harm.
 	 */
 	spinlock_release(&kmalloc_spinlock);
 	va = alloc_kpages(1);
@@ -239,17 +233,12 @@ allocpagerefpage(struct kheap_root *root)
 	}
 	KASSERT(va % PAGE_SIZE == 0);
 
-	if (root->page != NULL) {
-		/* Oops, somebody else allocated it. */
-		spinlock_release(&kmalloc_spinlock);
-		free_kpages(va);
-		spinlock_acquire(&kmalloc_spinlock);
-		/* Once allocated it isn't ever freed. */
-		KASSERT(root->page != NULL);
-		return;
+	page = (struct pagerefpage *)va;
+	for (i=0; i<NPAGEREFS_PER_PAGE; i++) {
+		page->refs[i].next_all = freepagerefs;
+		freepagerefs = &page->refs[i];
 	}
-
-	root->page = (struct pagerefpage *)va;
+	numpagerefs += NPAGEREFS_PER_PAGE;
 }
 
 /*
@@ -259,44 +248,20 @@ static
 struct pageref *
 allocpageref(void)
 {
-	unsigned i,j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-		if (root->numinuse >= NPAGEREFS_PER_PAGE) {
-			continue;
-		}
+	struct pageref *pr;
 
-		/*
-		 * This should probably not be a linear search.
-		 */
-		for (i=0; i<INUSE_WORDS; i++) {
-			if (root->pagerefs_inuse[i]==0xffffffff) {
-				/* full */
-				continue;
-			}
-			for (k=1,j=0; k!=0; k<<=1,j++) {
-				if ((root->pagerefs_inuse[i] & k)==0) {
-					root->pagerefs_inuse[i] |= k;
-					root->numinuse++;
-					if (root->page == NULL) {
-						allocpagerefpage(root);
-					}
-					if (root->page == NULL) {
-						return NULL;
-					}
-					return &root->page->refs[i*32 + j];
-				}
-			}
-			KASSERT(0);
+	if (freepagerefs == NULL) {
+		allocpagerefpage();
+		if (freepagerefs == NULL) {
+			/* ran out */
+			return NULL;
 		}
 	}
 
-	/* ran out */
-	return NULL;
+	pr = freepagerefs;
+	freepagerefs = pr->next_all;
+	pr->next_all = NULL;
+	return pr;
 }
 
 /*
@@ -306,36 +271,12 @@ static
 void
 freepageref(struct pageref *p)
 {
-	size_t i, j;
-	uint32_t k;
-	unsigned whichroot;
-	struct kheap_root *root;
-	struct pagerefpage *page;
-
-	for (whichroot=0; whichroot < NUM_PAGEREFPAGES; whichroot++) {
-		root = &kheaproots[whichroot];
-
-		page = root->page;
-		if (page == NULL) {
-			KASSERT(root->numinuse == 0);
-			continue;
-		}
-
-		j = p-page->refs;
-		/* note: j is unsigned, don't test < 0 */
-		if (j < NPAGEREFS_PER_PAGE) {
-			/* on this page */
-			i = j/32;
-			k = ((uint32_t)1) << (j%32);
-			KASSERT((root->pagerefs_inuse[i] & k) != 0);
-			root->pagerefs_inuse[i] &= ~k;
-			KASSERT(root->numinuse > 0);
-			root->numinuse--;
-			return;
-		}
-	}
-	/* pageref wasn't on any of the pages */
-	KASSERT(0);
+	p->pageaddr_and_blocktype = 0;
+	p->next_samesize = NULL;
+	p->prev_samesize = NULL;
+	p->prev_all = NULL;
+	p->next_all = freepagerefs;
+	freepagerefs = p;
 }
 
 ////////////////////////////////////////
@@ -349,6 +290,108 @@ static struct pageref *allbase;
 
 ////////////////////////////////////////
 
+/*
+ * Map from heap page to the pageref that manages it, so kfree can
+ * find the page a pointer is on without searching the heap.
+ *
+ * This is a two-level table indexed by virtual page number. The top
+ * level is static and each entry covers 4M of address space; the
+ * second level is allocated a page at a time the first time the heap
+ * reaches into that 4M. Second-level pages are never freed, as there
+ * are never more than a handful of them.
+ */
+
+#define PAGEMAP_LEAFSIZE (PAGE_SIZE / sizeof(struct pageref *))
+#define PAGEMAP_NDIRS (((vaddr_t)-1 / PAGE_SIZE) / PAGEMAP_LEAFSIZE + 1)
+
+#define PAGEMAP_DIR(va)  (((va) / PAGE_SIZE) / PAGEMAP_LEAFSIZE)
+#define PAGEMAP_SLOT(va) (((va) / PAGE_SIZE) % PAGEMAP_LEAFSIZE)
+
+struct pagemapleaf {
+	struct pageref *refs[PAGEMAP_LEAFSIZE];
+};
+
+static struct pagemapleaf *pagemap[PAGEMAP_NDIRS];
+
+/*
+ * Make sure there's a second-level page covering VA. Returns false
+ * if we couldn't get one.
+ */
+static
+bool
+pagemap_prepare(vaddr_t va)
+{
+	unsigned dir;
+	vaddr_t leafva;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	dir = PAGEMAP_DIR(va);
+	if (pagemap[dir] != NULL) {
+		return true;
+	}
+
+	/* As in allocpagerefpage, drop the lock around alloc_kpages. */
+	spinlock_release(&kmalloc_spinlock);
+	leafva = alloc_kpages(1);
+	spinlock_acquire(&kmalloc_spinlock);
+	if (leafva == 0) {
+		kprintf("kmalloc: Couldn't get a page map page\n");
+		return false;
+	}
+	KASSERT(leafva % PAGE_SIZE == 0);
+
+	if (pagemap[dir] != NULL) {
+		/* Somebody else allocated it. */
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(leafva);
+		spinlock_acquire(&kmalloc_spinlock);
+		return true;
+	}
+
+	bzero((void *)leafva, PAGE_SIZE);
+	pagemap[dir] = (struct pagemapleaf *)leafva;
+	return true;
+}
+
+/*
+ * Return the pageref for the heap page VA is on, or NULL if it isn't
+ * a subpage heap page.
+ */
+static
+struct pageref *
+pagemap_get(vaddr_t va)
+{
+	struct pagemapleaf *leaf;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	leaf = pagemap[PAGEMAP_DIR(va)];
+	if (leaf == NULL) {
+		return NULL;
+	}
+	return leaf->refs[PAGEMAP_SLOT(va)];
+}
+
+/*
+ * Set the pageref for the heap page at VA. pagemap_prepare must have
+ * been called for VA first.
+ */
+static
+void
+pagemap_set(vaddr_t va, struct pageref *pr)
+{
+	struct pagemapleaf *leaf;
+
+	KASSERT(spinlock_do_i_hold(&kmalloc_spinlock));
+
+	leaf = pagemap[PAGEMAP_DIR(va)];
+	KASSERT(leaf != NULL);
+	leaf->refs[PAGEMAP_SLOT(va)] = pr;
+}
+
+////////////////////////////////////////
+
 #ifdef GUARDS
 
 /* Space returned to the client is filled with GUARD_RETBYTE */
@@ -445,6 +488,13 @@ checkguardband(vaddr_t blockaddr, size_t smallerblocksize, size_t blocksize)
 
 ////////////////////////////////////////
 
+/* PROFILE implies LABELS */
+#ifdef PROFILE
+#ifndef LABELS
+#define LABELS
+#endif
+#endif
+
 /* SLOWER implies SLOW */
 #ifdef SLOWER
 #ifndef SLOW
@@ -590,14 +640,14 @@ checksubpages(void)
 	for (i=0; i<NSIZES; i++) {
 		for (pr = sizebases[i]; pr != NULL; pr = pr->next_samesize) {
 			checksubpage(pr);
-			KASSERT(sc < TOTAL_PAGEREFS);
+			KASSERT(sc < numpagerefs);
 			sc++;
 		}
 	}
 
 	for (pr = allbase; pr != NULL; pr = pr->next_all) {
 		checksubpage(pr);
-		KASSERT(ac < TOTAL_PAGEREFS);
+		KASSERT(ac < numpagerefs);
 		ac++;
 	}
 
@@ -617,6 +667,9 @@ checksubpages(void)
 struct malloclabel {
 	vaddr_t label;
 	unsigned generation;
+#ifdef PROFILE
+	size_t size;		/* size the caller asked for */
+#endif
 };
 
 static unsigned mallocgeneration;
@@ -626,13 +679,18 @@ static unsigned mallocgeneration;
  */
 static
 void *
-establishlabel(void *block, vaddr_t label)
+establishlabel(void *block, vaddr_t label, size_t size)
 {
 	struct malloclabel *ml;
 
 	ml = block;
 	ml->label = label;
 	ml->generation = mallocgeneration;
+#ifdef PROFILE
+	ml->size = size;
+#else
+	(void)size;
+#endif
 	ml++;
 	return ml;
 }
@@ -693,12 +751,304 @@ dump_subpages(unsigned generation)
 	}
 }
 
+#ifdef PROFILE
+
+/*
+ * Whole-page allocations don't go through the subpage allocator and
+ * so have nowhere to keep a label. Remember them here instead.
+ */
+#define PROF_NBIG 128
+
+struct bigalloc {
+	vaddr_t addr;		/* 0 if the slot is free */
+	vaddr_t label;
+	size_t size;
+};
+
+static struct bigalloc bigallocs[PROF_NBIG];
+static unsigned bigallocs_lost;	/* allocations we had no room for */
+
+static
+void
+prof_addbig(vaddr_t addr, vaddr_t label, size_t size)
+{
+	unsigned i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<PROF_NBIG; i++) {
+		if (bigallocs[i].addr == 0) {
+			bigallocs[i].addr = addr;
+			bigallocs[i].label = label;
+			bigallocs[i].size = size;
+			spinlock_release(&kmalloc_spinlock);
+			return;
+		}
+	}
+	bigallocs_lost++;
+	spinlock_release(&kmalloc_spinlock);
+}
+
+static
+void
+prof_rembig(vaddr_t addr)
+{
+	unsigned i;
+
+	spinlock_acquire(&kmalloc_spinlock);
+	for (i=0; i<PROF_NBIG; i++) {
+		if (bigallocs[i].addr == addr) {
+			bigallocs[i].addr = 0;
+			break;
+		}
+	}
+	spinlock_release(&kmalloc_spinlock);
+}
+
+/*
+ * Per-call-site totals. The table is static because we build it with
+ * kmalloc_spinlock held; sites past the end are lumped together.
+ */
+#define PROF_NSITES 64
+
+struct profsite {
+	vaddr_t label;
+	unsigned count;
+	unsigned long reqbytes;		/* bytes asked for */
+	unsigned long usedbytes;	/* bytes actually taken up */
+};
+
+static struct profsite profsites[PROF_NSITES];
+static struct profsite profother;
+
+/*
+ * Request size histogram. Each block size is split into PROF_NSUB
+ * equal buckets covering the request sizes that round up to it; one
+ * more row counts whole-page allocations.
+ */
+#define PROF_NSUB 4
+
+struct profbucket {
+	unsigned count;
+	unsigned long reqbytes;
+};
+
+static struct profbucket profhist[NSIZES + 1][PROF_NSUB];
+
+static
+void
+prof_record(vaddr_t label, size_t reqsize, size_t usedsize, int blktype)
+{
+	struct profsite *ps;
+	size_t lo, hi;
+	unsigned i, sub;
+
+	ps = &profother;
+	for (i=0; i<PROF_NSITES; i++) {
+		if (profsites[i].count == 0) {
+			profsites[i].label = label;
+		}
+		if (profsites[i].label == label) {
+			ps = &profsites[i];
+			break;
+		}
+	}
+	ps->count++;
+	ps->reqbytes += reqsize;
+	ps->usedbytes += usedsize;
+
+	if (blktype < NSIZES) {
+		lo = blktype > 0 ? sizes[blktype-1] : 0;
+		hi = sizes[blktype];
+		sub = (reqsize + LABEL_OVERHEAD + GUARD_OVERHEAD - lo - 1) *
+			PROF_NSUB / (hi - lo);
+		if (sub >= PROF_NSUB) {
+			sub = PROF_NSUB - 1;
+		}
+	}
+	else {
+		sub = 0;
+	}
+	profhist[blktype][sub].count++;
+	profhist[blktype][sub].reqbytes += reqsize;
+}
+
+/*
+ * Tally all the live allocations on one subpage heap page.
+ */
+static
+void
+prof_subpage(struct pageref *pr)
+{
+	int blktype = PR_BLOCKTYPE(pr);
+	unsigned blocksize = sizes[blktype];
+	unsigned numblocks = PAGE_SIZE / blocksize;
+	uint32_t isfree[DIVROUNDUP(PAGE_SIZE / SMALLEST_SUBPAGE_SIZE, 32)];
+	vaddr_t prpage;
+	struct freelist *fl;
+	struct malloclabel *ml;
+	unsigned i;
+
+	for (i=0; i<ARRAYCOUNT(isfree); i++) {
+		isfree[i] = 0;
+	}
+
+	prpage = PR_PAGEADDR(pr);
+	if (pr->freelist_offset != INVALID_OFFSET) {
+		fl = (struct freelist *)(prpage + pr->freelist_offset);
+		for (; fl != NULL; fl = fl->next) {
+			i = ((vaddr_t)fl - prpage) / blocksize;
+			isfree[i / 32] |= 1U << (i % 32);
+		}
+	}
+
+	for (i=0; i<numblocks; i++) {
+		if (isfree[i / 32] & (1U << (i % 32))) {
+			continue;
+		}
+		ml = (struct malloclabel *)(prpage + i * blocksize);
+		prof_record(ml->label, ml->size, blocksize, blktype);
+	}
+}
+
+/*
+ * Print the PROF_NTOP sites with the largest value of either bytes
+ * or count, without sorting the table.
+ */
+#define PROF_NTOP 10
+
+static
+void
+prof_printtop(bool bybytes)
+{
+	bool shown[PROF_NSITES];
+	unsigned i, n, best;
+	unsigned long val, bestval;
+	struct profsite *ps;
+
+	for (i=0; i<PROF_NSITES; i++) {
+		shown[i] = false;
+	}
+
+	kprintf("Top call sites by %s:\n", bybytes ? "bytes" : "count");
+	kprintf("  %-10s %7s %10s %10s %6s\n",
+		"site", "count", "requested", "used", "waste");
+	for (n=0; n<PROF_NTOP; n++) {
+		best = PROF_NSITES;
+		bestval = 0;
+		for (i=0; i<PROF_NSITES; i++) {
+			ps = &profsites[i];
+			if (ps->count == 0 || shown[i]) {
+				continue;
+			}
+			val = bybytes ? ps->usedbytes : ps->count;
+			if (best == PROF_NSITES || val > bestval) {
+				best = i;
+				bestval = val;
+			}
+		}
+		if (best == PROF_NSITES) {
+			break;
+		}
+		shown[best] = true;
+		ps = &profsites[best];
+		kprintf("  %p %7u %10lu %10lu %5lu%%\n",
+			(void *)ps->label, ps->count, ps->reqbytes,
+			ps->usedbytes,
+			(ps->usedbytes - ps->reqbytes) * 100 / ps->usedbytes);
+	}
+	if (profother.count > 0) {
+		kprintf("  %-10s %7u %10lu %10lu\n", "(others)",
+			profother.count, profother.reqbytes,
+			profother.usedbytes);
+	}
+}
+
+static
+void
+prof_printhist(void)
+{
+	unsigned i, j, count;
+	size_t lo, hi, blo, bhi;
+	unsigned long req, used;
+
+	kprintf("Request sizes (after label/guard overhead) by block size:\n");
+	kprintf("  %-11s %7s %10s %10s %6s\n",
+		"request", "count", "requested", "used", "waste");
+	for (i=0; i<NSIZES; i++) {
+		lo = i > 0 ? sizes[i-1] : 0;
+		hi = sizes[i];
+		for (j=0; j<PROF_NSUB; j++) {
+			count = profhist[i][j].count;
+			if (count == 0) {
+				continue;
+			}
+			blo = lo + (hi - lo) * j / PROF_NSUB + 1;
+			bhi = lo + (hi - lo) * (j + 1) / PROF_NSUB;
+			req = profhist[i][j].reqbytes;
+			used = (unsigned long)count * hi;
+			kprintf("  %4zu-%-4zu   %7u %10lu %10lu %5lu%%\n",
+				blo, bhi, count, req, used,
+				(used - req) * 100 / used);
+		}
+	}
+	if (profhist[NSIZES][0].count > 0) {
+		kprintf("  %-11s %7u %10lu\n", "pages",
+			profhist[NSIZES][0].count,
+			profhist[NSIZES][0].reqbytes);
+	}
+}
+
+#endif /* PROFILE */
+
 #else
 
 #define LABEL_OVERHEAD 0
 
 #endif /* LABELS */
 
+/*
+ * Print the live heap by call site and by request size.
+ */
+void
+kheap_printprofile(void)
+{
+#ifdef PROFILE
+	struct pageref *pr;
+	unsigned i;
+	size_t used;
+
+	/* print the whole thing with interrupts off */
+	spinlock_acquire(&kmalloc_spinlock);
+
+	bzero(profsites, sizeof(profsites));
+	bzero(&profother, sizeof(profother));
+	bzero(profhist, sizeof(profhist));
+
+	for (pr = allbase; pr != NULL; pr = pr->next_all) {
+		prof_subpage(pr);
+	}
+	for (i=0; i<PROF_NBIG; i++) {
+		if (bigallocs[i].addr != 0) {
+			used = ROUNDUP(bigallocs[i].size, PAGE_SIZE);
+			prof_record(bigallocs[i].label, bigallocs[i].size,
+				    used, NSIZES);
+		}
+	}
+
+	prof_printtop(true);
+	prof_printtop(false);
+	prof_printhist();
+	if (bigallocs_lost > 0) {
+		kprintf("(%u whole-page allocations were not tracked)\n",
+			bigallocs_lost);
+	}
+
+	spinlock_release(&kmalloc_spinlock);
+#else
+	kprintf("Enable PROFILE in kmalloc.c to use this functionality.\n");
+#endif
+}
+
 void
 kheap_nextgeneration(void)
 {
@@ -864,6 +1214,30 @@ kheap_printused(void)
 
 ////////////////////////////////////////
 
+/*
+ * Add a pageref to the head of both lists.
+ */
+static
+void
+add_lists(struct pageref *pr, int blktype)
+{
+	KASSERT(blktype>=0 && blktype<NSIZES);
+
+	pr->next_samesize = sizebases[blktype];
+	pr->prev_samesize = &sizebases[blktype];
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = &pr->next_samesize;
+	}
+	sizebases[blktype] = pr;
+
+	pr->next_all = allbase;
+	pr->prev_all = &allbase;
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = &pr->next_all;
+	}
+	allbase = pr;
+}
+
 /*
  * Remove a pageref from both lists that it's on.
  */
@@ -871,24 +1245,18 @@ static
 void
 remove_lists(struct pageref *pr, int blktype)
 {
-	struct pageref **guy;
-
 	KASSERT(blktype>=0 && blktype<NSIZES);
 
-	for (guy = &sizebases[blktype]; *guy; guy = &(*guy)->next_samesize) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_samesize;
-			break;
-		}
+	KASSERT(*pr->prev_samesize == pr);
+	*pr->prev_samesize = pr->next_samesize;
+	if (pr->next_samesize != NULL) {
+		pr->next_samesize->prev_samesize = pr->prev_samesize;
 	}
 
-	for (guy = &allbase; *guy; guy = &(*guy)->next_all) {
-		checksubpage(*guy);
-		if (*guy == pr) {
-			*guy = pr->next_all;
-			break;
-		}
+	KASSERT(*pr->prev_all == pr);
+	*pr->prev_all = pr->next_all;
+	if (pr->next_all != NULL) {
+		pr->next_all->prev_all = pr->prev_all;
 	}
 }
 
@@ -938,6 +1306,9 @@ subpage_kmalloc(size_t sz
 #ifdef GUARDS
 	size_t clientsz;
 #endif
+#ifdef LABELS
+	size_t reqsz = sz;	// what the caller asked for
+#endif
 
 #ifdef GUARDS
 	clientsz = sz;
@@ -992,7 +1363,7 @@ subpage_kmalloc(size_t sz
 			retptr = establishguardband(retptr, clientsz, sz);
 #endif
 #ifdef LABELS
-			retptr = establishlabel(retptr, label);
+			retptr = establishlabel(retptr, label, reqsz);
 #endif
 
 			checksubpages();
@@ -1025,6 +1396,12 @@ subpage_kmalloc(size_t sz
 #endif
 	spinlock_acquire(&kmalloc_spinlock);
 
+	if (!pagemap_prepare(prpage)) {
+		spinlock_release(&kmalloc_spinlock);
+		free_kpages(prpage);
+		return NULL;
+	}
+
 	pr = allocpageref();
 	if (pr==NULL) {
 		/* Couldn't allocate accounting space for the new page. */
@@ -1055,11 +1432,8 @@ subpage_kmalloc(size_t sz
 	pr->freelist_offset = fla - prpage;
 	KASSERT(pr->freelist_offset == (pr->nfree-1)*sizes[blktype]);
 
-	pr->next_samesize = sizebases[blktype];
-	sizebases[blktype] = pr;
-
-	pr->next_all = allbase;
-	allbase = pr;
+	add_lists(pr, blktype);
+	pagemap_set(prpage, pr);
 
 	/* This is kind of cheesy, but avoids duplicating the alloc code. */
 	goto doalloc;
@@ -1113,30 +1487,21 @@ subpage_kfree(void *ptr)
 
 	checksubpages();
 
-	/* Silence warnings with gcc 4.8 -Og (but not -O2) */
-	prpage = 0;
-	blktype = 0;
-
-	for (pr = allbase; pr; pr = pr->next_all) {
-		prpage = PR_PAGEADDR(pr);
-		blktype = PR_BLOCKTYPE(pr);
-		KASSERT(blktype >= 0 && blktype < NSIZES);
-
-		/* check for corruption */
-		KASSERT(blktype>=0 && blktype<NSIZES);
-		checksubpage(pr);
-
-		if (ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE) {
-			break;
-		}
-	}
-
+	pr = pagemap_get(ptraddr);
 	if (pr==NULL) {
 		/* Not on any of our pages - not a subpage allocation */
 		spinlock_release(&kmalloc_spinlock);
 		return -1;
 	}
 
+	prpage = PR_PAGEADDR(pr);
+	blktype = PR_BLOCKTYPE(pr);
+
+	/* check for corruption */
+	KASSERT(blktype>=0 && blktype<NSIZES);
+	KASSERT(ptraddr >= prpage && ptraddr < prpage + PAGE_SIZE);
+	checksubpage(pr);
+
 	offset = ptraddr - prpage;
 
 	/* Check for proper positioning and alignment */
@@ -1189,6 +1554,7 @@ subpage_kfree(void *ptr)
 	if (pr->nfree == PAGE_SIZE / sizes[blktype]) {
 		/* Whole page is free. */
 		remove_lists(pr, blktype);
+		pagemap_set(prpage, NULL);
 		freepageref(pr);
 		/* Call free_kpages without kmalloc_spinlock. */
 		spinlock_release(&kmalloc_spinlock);
@@ -1242,6 +1608,9 @@ kmalloc(size_t sz)
 			return NULL;
 		}
 		KASSERT(address % PAGE_SIZE == 0);
+#ifdef PROFILE
+		prof_addbig(address, label, sz);
+#endif
 
 		return (void *)address;
 	}
@@ -1266,6 +1635,9 @@ kfree(void *ptr)
 		return;
 	} else if (subpage_kfree(ptr)) {
 		KASSERT((vaddr_t)ptr%PAGE_SIZE==0);
+#ifdef PROFILE
+		prof_rembig((vaddr_t)ptr);
+#endif
 		free_kpages((vaddr_t)ptr);
 	}
 }
@@ -0,0 +1,378 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vm.h>
+#include <kmem_cache.h>
+
+/*
+ * Typed object caches (slab allocator).
+ *
+ * Each slab is one page. The slab header sits at the start of the page,
+ * followed by an array of free-list links (one per object) and then the
+ * objects themselves. Free objects are chained by index through
+ * ks_freenext[] rather than through the objects' own memory, so a free
+ * object keeps the state its constructor gave it.
+ *
+ * Slabs that have at least one free object are kept on the cache's
+ * kc_slabs list. Full slabs are on no list; kmem_cache_free finds the slab
+ * from the object address, since a slab never crosses a page boundary.
+ * One completely free slab is kept around per cache to avoid bouncing
+ * pages back and forth with the page allocator; any further free slabs
+ * are handed back right away.
+ */
+
+struct kmem_slab {
+    struct kmem_cache *ks_cache;    /* Cache this slab belongs to. */
+    struct kmem_slab *ks_next;      /* Links on kc_slabs. */
+    struct kmem_slab *ks_prev;
+    uint16_t ks_nfree;              /* Number of free objects. */
+    uint16_t ks_freehead;           /* Index of the first free object. */
+    uint16_t ks_freenext[];         /* Per object: next free index. */
+};
+
+#define KS_NONE     0xffff          /* End of the free list. */
+#define KS_INUSE    0xfffe          /* ks_freenext[] value of a live object. */
+
+#define KMEM_ALIGN  8
+
+/*
+ * List of all caches, for the statistics.
+ */
+static struct kmem_cache *allcaches;
+static struct spinlock allcaches_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Offset of the first object in a slab holding 'perslab' objects.
+ */
+static
+size_t
+slab_firstobj(unsigned perslab)
+{
+    return ROUNDUP(sizeof(struct kmem_slab) + perslab * sizeof(uint16_t),
+                   KMEM_ALIGN);
+}
+
+/*
+ * Work out the slab layout for a cache. Idempotent, so statically
+ * initialized caches can call it lazily.
+ */
+static
+void
+kmem_cache_setup(struct kmem_cache *kc)
+{
+    unsigned n;
+
+    KASSERT(kc->kc_size > 0);
+
+    kc->kc_objsize = ROUNDUP(kc->kc_size, KMEM_ALIGN);
+
+    n = (PAGE_SIZE - sizeof(struct kmem_slab)) /
+        (kc->kc_objsize + sizeof(uint16_t));
+    while (n > 0 && slab_firstobj(n) + n * kc->kc_objsize > PAGE_SIZE) {
+        n--;
+    }
+    if (n == 0) {
+        panic("kmem_cache %s: %zu-byte objects don't fit in a slab\n",
+              kc->kc_name, kc->kc_size);
+    }
+    KASSERT(n < KS_INUSE);
+
+    kc->kc_firstobj = slab_firstobj(n);
+    kc->kc_perslab = n;
+}
+
+/*
+ * Put a cache on the list of all caches, if it isn't already.
+ */
+static
+void
+kmem_cache_register(struct kmem_cache *kc)
+{
+    spinlock_acquire(&allcaches_lock);
+    if (!kc->kc_registered) {
+        kc->kc_next = allcaches;
+        allcaches = kc;
+        kc->kc_registered = true;
+    }
+    spinlock_release(&allcaches_lock);
+}
+
+static
+void *
+slab_obj(struct kmem_cache *kc, struct kmem_slab *ks, unsigned i)
+{
+    return (char *)ks + kc->kc_firstobj + i * kc->kc_objsize;
+}
+
+static
+void
+slab_link(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+    KASSERT(spinlock_do_i_hold(&kc->kc_lock));
+
+    ks->ks_prev = NULL;
+    ks->ks_next = kc->kc_slabs;
+    if (ks->ks_next != NULL) {
+        ks->ks_next->ks_prev = ks;
+    }
+    kc->kc_slabs = ks;
+}
+
+static
+void
+slab_unlink(struct kmem_cache *kc, struct kmem_slab *ks)
+{
+    if (ks->ks_prev != NULL) {
+        ks->ks_prev->ks_next = ks->ks_next;
+    }
+    else {
+        KASSERT(kc->kc_slabs == ks);
+        kc->kc_slabs = ks->ks_next;
+    }
+    if (ks->ks_next != NULL) {
+        ks->ks_next->ks_prev = ks->ks_prev;
+    }
+    ks->ks_next = NULL;
+    ks->ks_prev = NULL;
+}
+
+/*
+ * Get a page and turn it into a slab of free, constructed objects.
+ * Called without the cache lock, since both alloc_kpages and the
+ * constructor may need to take other locks.
+ */
+static
+struct kmem_slab *
+slab_create(struct kmem_cache *kc)
+{
+    struct kmem_slab *ks;
+    vaddr_t page;
+
+    KASSERT(kc->kc_perslab > 0);
+
+    page = alloc_kpages(1);
+    if (page == 0) {
+        return NULL;
+    }
+
+    ks = (struct kmem_slab *)page;
+    ks->ks_cache = kc;
+    ks->ks_next = NULL;
+    ks->ks_prev = NULL;
+    ks->ks_nfree = kc->kc_perslab;
+    ks->ks_freehead = 0;
+    for (unsigned i = 0; i < kc->kc_perslab; ++i) {
+        ks->ks_freenext[i] = (i + 1 < kc->kc_perslab) ? i + 1 : KS_NONE;
+        if (kc->kc_ctor != NULL) {
+            kc->kc_ctor(slab_obj(kc, ks, i));
+        }
+    }
+
+    return ks;
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name, size_t size, void (*ctor)(void *obj))
+{
+    struct kmem_cache *kc;
+
+    kc = kmalloc(sizeof(*kc));
+    if (kc == NULL) {
+        return NULL;
+    }
+    bzero(kc, sizeof(*kc));
+
+    kc->kc_name = name;
+    kc->kc_size = size;
+    kc->kc_ctor = ctor;
+    spinlock_init(&kc->kc_lock);
+    kmem_cache_setup(kc);
+
+    kmem_cache_register(kc);
+
+    return kc;
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *kc)
+{
+    struct kmem_cache **kcp;
+    struct kmem_slab *ks;
+
+    KASSERT(kc != NULL);
+    KASSERT(kc->kc_inuse == 0);
+
+    spinlock_acquire(&allcaches_lock);
+    for (kcp = &allcaches; *kcp != NULL; kcp = &(*kcp)->kc_next) {
+        if (*kcp == kc) {
+            *kcp = kc->kc_next;
+            break;
+        }
+    }
+    spinlock_release(&allcaches_lock);
+
+    /* Nobody else may be using the cache, so no need for kc_lock. */
+    while ((ks = kc->kc_slabs) != NULL) {
+        KASSERT(ks->ks_nfree == kc->kc_perslab);
+        slab_unlink(kc, ks);
+        free_kpages((vaddr_t)ks);
+    }
+
+    spinlock_cleanup(&kc->kc_lock);
+    kfree(kc);
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *kc)
+{
+    struct kmem_slab *ks;
+    unsigned i;
+
+    spinlock_acquire(&kc->kc_lock);
+
+    if (kc->kc_perslab == 0) {
+        kmem_cache_setup(kc);
+    }
+
+    if (kc->kc_slabs == NULL) {
+        /*
+         * Grow the cache. Somebody else may grow it at the same time;
+         * that just leaves an extra free slab around.
+         */
+        spinlock_release(&kc->kc_lock);
+        kmem_cache_register(kc);
+        ks = slab_create(kc);
+        if (ks == NULL) {
+            return NULL;
+        }
+        spinlock_acquire(&kc->kc_lock);
+
+        slab_link(kc, ks);
+        kc->kc_nslabs++;
+        kc->kc_nempty++;
+        kc->kc_grows++;
+    }
+
+    ks = kc->kc_slabs;
+    KASSERT(ks->ks_cache == kc);
+    KASSERT(ks->ks_nfree > 0);
+    KASSERT(ks->ks_freehead != KS_NONE);
+
+    if (ks->ks_nfree == kc->kc_perslab) {
+        KASSERT(kc->kc_nempty > 0);
+        kc->kc_nempty--;
+    }
+
+    i = ks->ks_freehead;
+    ks->ks_freehead = ks->ks_freenext[i];
+    ks->ks_freenext[i] = KS_INUSE;
+    ks->ks_nfree--;
+    if (ks->ks_nfree == 0) {
+        /* Full slabs aren't kept on any list. */
+        slab_unlink(kc, ks);
+    }
+
+    kc->kc_inuse++;
+    kc->kc_allocs++;
+
+    spinlock_release(&kc->kc_lock);
+
+    return slab_obj(kc, ks, i);
+}
+
+void
+kmem_cache_free(struct kmem_cache *kc, void *obj)
+{
+    struct kmem_slab *ks;
+    vaddr_t offset;
+    unsigned i;
+
+    if (obj == NULL) {
+        return;
+    }
+
+    ks = (struct kmem_slab *)((vaddr_t)obj & PAGE_FRAME);
+    KASSERT(ks->ks_cache == kc);
+
+    offset = (vaddr_t)obj - (vaddr_t)ks - kc->kc_firstobj;
+    if (offset % kc->kc_objsize != 0 ||
+        offset / kc->kc_objsize >= kc->kc_perslab) {
+        panic("kmem_cache_free: %s: invalid object %p\n", kc->kc_name, obj);
+    }
+    i = offset / kc->kc_objsize;
+
+    spinlock_acquire(&kc->kc_lock);
+
+    if (ks->ks_freenext[i] != KS_INUSE) {
+        panic("kmem_cache_free: %s: %p freed twice\n", kc->kc_name, obj);
+    }
+
+    ks->ks_freenext[i] = ks->ks_freehead;
+    ks->ks_freehead = i;
+    ks->ks_nfree++;
+    if (ks->ks_nfree == 1) {
+        /* It was full; it has a free object again. */
+        slab_link(kc, ks);
+    }
+
+    KASSERT(kc->kc_inuse > 0);
+    kc->kc_inuse--;
+    kc->kc_frees++;
+
+    if (ks->ks_nfree == kc->kc_perslab) {
+        if (kc->kc_nempty > 0) {
+            /* Already holding a free slab; give this one back. */
+            slab_unlink(kc, ks);
+            kc->kc_nslabs--;
+            kc->kc_reaps++;
+            spinlock_release(&kc->kc_lock);
+            free_kpages((vaddr_t)ks);
+            return;
+        }
+        kc->kc_nempty++;
+    }
+
+    spinlock_release(&kc->kc_lock);
+}
+
+/*
+ * Memory kmalloc would use for one object of 'size' bytes, for
+ * comparison with the cache's footprint.
+ */
+static
+size_t
+kmalloc_footprint(size_t size)
+{
+    size_t block;
+
+    if (size >= 2048) {
+        return ROUNDUP(size, PAGE_SIZE);
+    }
+    for (block = 16; block < size; block *= 2) {
+        /* nothing */
+    }
+    return block;
+}
+
+void
+kmem_cache_printstats(void)
+{
+    struct kmem_cache *kc;
+
+    kprintf("%-14s %5s %5s %4s %5s %6s %9s %9s %8s %8s\n",
+            "cache", "size", "objsz", "/slb", "slabs", "inuse",
+            "allocs", "frees", "bytes", "kmalloc");
+
+    /* print the whole thing with interrupts off */
+    spinlock_acquire(&allcaches_lock);
+    for (kc = allcaches; kc != NULL; kc = kc->kc_next) {
+        spinlock_acquire(&kc->kc_lock);
+        kprintf("%-14s %5zu %5zu %4u %5u %6u %9lu %9lu %8lu %8lu\n",
+                kc->kc_name, kc->kc_size, kc->kc_objsize, kc->kc_perslab,
+                kc->kc_nslabs, kc->kc_inuse, kc->kc_allocs, kc->kc_frees,
+                (unsigned long)kc->kc_nslabs * PAGE_SIZE,
+                (unsigned long)kc->kc_inuse * kmalloc_footprint(kc->kc_size));
+        spinlock_release(&kc->kc_lock);
+    }
+    spinlock_release(&allcaches_lock);
+}
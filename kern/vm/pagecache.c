@@ -0,0 +1,276 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <kmem_cache.h>
+#include <vm.h>
+#include <coremap.h>
+#include <pagecache.h>
+
+/*
+ * Cached pages are hashed by (vnode, offset) and also kept on a list
+ * from least to most recently looked up, for reclaiming. One spinlock
+ * covers all of it; nothing that can sleep happens while it's held,
+ * so entries are unlinked first and freed afterwards.
+ */
+
+#define PC_NBUCKETS     256
+
+struct pc_entry {
+    struct vnode *pe_vnode;         /* File; we hold a reference. */
+    off_t pe_offset;                /* Where the page starts in it. */
+    size_t pe_len;                  /* Bytes from the file; then zeros. */
+    paddr_t pe_pa;                  /* The page; we hold a reference. */
+    struct pc_entry *pe_hashnext;
+    struct pc_entry *pe_lruprev;
+    struct pc_entry *pe_lrunext;
+};
+
+static struct kmem_cache pc_entrycache =
+    KMEM_CACHE_INITIALIZER("pagecache", sizeof(struct pc_entry), NULL);
+
+static struct pc_entry *pc_buckets[PC_NBUCKETS];
+static struct pc_entry *pc_lruhead;         /* Least recently used. */
+static struct pc_entry *pc_lrutail;
+static struct spinlock pc_lock = SPINLOCK_INITIALIZER;
+
+static unsigned pc_npages;
+static unsigned pc_hits;
+static unsigned pc_misses;
+static unsigned pc_reclaimed;
+static unsigned pc_purged;
+
+static
+struct pc_entry **
+pc_bucket(struct vnode *vn, off_t offset)
+{
+    uintptr_t h;
+
+    h = (uintptr_t)vn / sizeof(void *) + (uintptr_t)(offset / PAGE_SIZE);
+    return &pc_buckets[h % PC_NBUCKETS];
+}
+
+static
+struct pc_entry *
+pc_find(struct vnode *vn, off_t offset, size_t len)
+{
+    struct pc_entry *pe;
+
+    for (pe = *pc_bucket(vn, offset); pe != NULL; pe = pe->pe_hashnext) {
+        if (pe->pe_vnode == vn && pe->pe_offset == offset &&
+            pe->pe_len == len) {
+            return pe;
+        }
+    }
+    return NULL;
+}
+
+static
+void
+pc_lruadd(struct pc_entry *pe)
+{
+    pe->pe_lrunext = NULL;
+    pe->pe_lruprev = pc_lrutail;
+    if (pc_lrutail != NULL) {
+        pc_lrutail->pe_lrunext = pe;
+    }
+    else {
+        pc_lruhead = pe;
+    }
+    pc_lrutail = pe;
+}
+
+static
+void
+pc_lruremove(struct pc_entry *pe)
+{
+    if (pe->pe_lruprev != NULL) {
+        pe->pe_lruprev->pe_lrunext = pe->pe_lrunext;
+    }
+    else {
+        pc_lruhead = pe->pe_lrunext;
+    }
+    if (pe->pe_lrunext != NULL) {
+        pe->pe_lrunext->pe_lruprev = pe->pe_lruprev;
+    }
+    else {
+        pc_lrutail = pe->pe_lruprev;
+    }
+}
+
+/*
+ * Take PE out of the cache and put it on *FREELIST (threaded through
+ * pe_hashnext) for pc_free.
+ */
+static
+void
+pc_unlink(struct pc_entry *pe, struct pc_entry **freelist)
+{
+    struct pc_entry **pp;
+
+    for (pp = pc_bucket(pe->pe_vnode, pe->pe_offset); *pp != pe;
+         pp = &(*pp)->pe_hashnext) {
+        KASSERT(*pp != NULL);
+    }
+    *pp = pe->pe_hashnext;
+    pc_lruremove(pe);
+    pc_npages--;
+
+    pe->pe_hashnext = *freelist;
+    *freelist = pe;
+}
+
+/*
+ * Drop the references held by unlinked entries and free them. Call
+ * without pc_lock.
+ */
+static
+void
+pc_free(struct pc_entry *freelist)
+{
+    struct pc_entry *pe;
+
+    while (freelist != NULL) {
+        pe = freelist;
+        freelist = pe->pe_hashnext;
+        coremap_free_upage(pe->pe_pa);
+        VOP_DECREF(pe->pe_vnode);
+        kmem_cache_free(&pc_entrycache, pe);
+    }
+}
+
+paddr_t
+pagecache_lookup(struct vnode *vn, off_t offset, size_t len)
+{
+    struct pc_entry *pe;
+    paddr_t pa;
+
+    KASSERT(offset % PAGE_SIZE == 0);
+
+    spinlock_acquire(&pc_lock);
+    pe = pc_find(vn, offset, len);
+    if (pe == NULL) {
+        spinlock_release(&pc_lock);
+        return 0;
+    }
+    pa = pe->pe_pa;
+    coremap_share(pa);
+    pc_lruremove(pe);
+    pc_lruadd(pe);
+    pc_hits++;
+    spinlock_release(&pc_lock);
+
+    return pa;
+}
+
+paddr_t
+pagecache_insert(struct vnode *vn, off_t offset, size_t len, paddr_t pa)
+{
+    struct pc_entry *pe, *old;
+    struct pc_entry **bucket;
+
+    KASSERT(offset % PAGE_SIZE == 0);
+
+    /* Not caching it is fine; the caller just has it to itself. */
+    pe = kmem_cache_alloc(&pc_entrycache);
+    if (pe == NULL) {
+        return pa;
+    }
+
+    spinlock_acquire(&pc_lock);
+    old = pc_find(vn, offset, len);
+    if (old != NULL) {
+        pa = old->pe_pa;
+        coremap_share(pa);
+        pc_hits++;
+        spinlock_release(&pc_lock);
+        kmem_cache_free(&pc_entrycache, pe);
+        return pa;
+    }
+
+    VOP_INCREF(vn);
+    coremap_share(pa);
+    pe->pe_vnode = vn;
+    pe->pe_offset = offset;
+    pe->pe_len = len;
+    pe->pe_pa = pa;
+    bucket = pc_bucket(vn, offset);
+    pe->pe_hashnext = *bucket;
+    *bucket = pe;
+    pc_lruadd(pe);
+    pc_npages++;
+    pc_misses++;
+    spinlock_release(&pc_lock);
+
+    return pa;
+}
+
+unsigned
+pagecache_reclaim(unsigned max)
+{
+    struct pc_entry *pe, *next, *freelist;
+    unsigned n;
+
+    n = 0;
+    freelist = NULL;
+    spinlock_acquire(&pc_lock);
+    for (pe = pc_lruhead; pe != NULL && n < max; pe = next) {
+        next = pe->pe_lrunext;
+        /* Nobody can start mapping it while we hold pc_lock. */
+        if (coremap_refcount(pe->pe_pa) == 1) {
+            pc_unlink(pe, &freelist);
+            n++;
+        }
+    }
+    pc_reclaimed += n;
+    spinlock_release(&pc_lock);
+
+    pc_free(freelist);
+    return n;
+}
+
+void
+pagecache_purge(struct vnode *vn)
+{
+    struct pc_entry *pe, *next, *freelist;
+
+    freelist = NULL;
+    spinlock_acquire(&pc_lock);
+    for (pe = pc_lruhead; pe != NULL; pe = next) {
+        next = pe->pe_lrunext;
+        if (pe->pe_vnode == vn) {
+            pc_unlink(pe, &freelist);
+            pc_purged++;
+        }
+    }
+    spinlock_release(&pc_lock);
+
+    pc_free(freelist);
+}
+
+void
+pagecache_purgefs(struct fs *fs)
+{
+    struct pc_entry *pe, *next, *freelist;
+
+    freelist = NULL;
+    spinlock_acquire(&pc_lock);
+    for (pe = pc_lruhead; pe != NULL; pe = next) {
+        next = pe->pe_lrunext;
+        if (pe->pe_vnode->vn_fs == fs) {
+            pc_unlink(pe, &freelist);
+            pc_purged++;
+        }
+    }
+    spinlock_release(&pc_lock);
+
+    pc_free(freelist);
+}
+
+void
+pagecache_printstats(void)
+{
+    kprintf("page cache: %u pages, %u hits, %u misses, %u reclaimed, "
+            "%u purged\n", pc_npages, pc_hits, pc_misses, pc_reclaimed,
+            pc_purged);
+}
@@ -0,0 +1,274 @@
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <synch.h>
+#include <wchan.h>
+#include <thread.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <vmprivate.h>
+
+/*
+ * Page replacement.
+ *
+ * Victims come from a clock over the coremap (coremap_nextvictim). The
+ * hardware has no referenced bit, so a page counts as referenced if it
+ * was loaded into a TLB since the hand last passed it.
+ *
+ * Unmapped pages in the page cache cost nothing to drop, so they go
+ * before anything is written to swap.
+ *
+ * Evicting a page needs its owner's as_lock. Pageout only tries for
+ * it and passes over pages whose owner is busy: a thread faulting on a
+ * user buffer in the middle of a read or write holds vfs_biglock, and
+ * the lock's holder may be waiting for that. Nobody else holds one
+ * address space's lock while waiting for another, or while allocating
+ * user pages, so pageout can hold several at once to batch its writes.
+ */
+
+struct victim {
+    struct addrspace *v_as;
+    vaddr_t v_va;
+    paddr_t v_pa;
+    unsigned v_slot;
+    bool v_dirty;                   /* Needs writing to v_slot. */
+    bool v_locked;                  /* We took v_as's lock for this one. */
+};
+
+static struct lock *pageout_biglock;
+static struct wchan *pageout_wchan;
+static struct spinlock pageout_spinlock = SPINLOCK_INITIALIZER;
+static bool pageout_wanted;
+
+void
+pageout_lock(void)
+{
+    if (pageout_biglock != NULL) {
+        lock_acquire(pageout_biglock);
+    }
+}
+
+bool
+pageout_trylock(void)
+{
+    return pageout_biglock != NULL && lock_tryacquire(pageout_biglock);
+}
+
+void
+pageout_unlock(void)
+{
+    if (pageout_biglock != NULL) {
+        lock_release(pageout_biglock);
+    }
+}
+
+/*
+ * Take the next victim off the clock and unmap it. Returns false if
+ * there's nothing more to take (or swap is full).
+ */
+static
+bool
+pageout_pick(struct victim *v, bool *gotone, struct vm_shootdownbatch *sb)
+{
+    pte_t *pte;
+
+    *gotone = false;
+    if (!coremap_nextvictim(&v->v_as, &v->v_va, &v->v_pa)) {
+        return false;
+    }
+
+    v->v_locked = !lock_do_i_hold(v->v_as->as_lock);
+    if (v->v_locked && !lock_tryacquire(v->v_as->as_lock)) {
+        return true;
+    }
+
+    /* The page may have moved on while we weren't holding the lock. */
+    pte = pt_get(v->v_as->as_pt, v->v_va, false);
+    if (pte == NULL || !(*pte & PTE_PRESENT) || (*pte & PTE_ZERO) ||
+        (*pte & PTE_FRAME) != v->v_pa || coremap_refcount(v->v_pa) != 1) {
+        goto skip;
+    }
+
+    /* A page with a slot is clean; the slot is still up to date. */
+    v->v_slot = coremap_getslot(v->v_pa);
+    v->v_dirty = v->v_slot == 0;
+    if (v->v_dirty) {
+        v->v_slot = swap_alloc();
+        if (v->v_slot == 0) {
+            if (v->v_locked) {
+                lock_release(v->v_as->as_lock);
+            }
+            return false;
+        }
+    }
+    else {
+        /* The page table takes over the coremap's reference. */
+        coremap_setslot(v->v_pa, 0);
+    }
+
+    /* The owner blocks on as_lock until the write is done. */
+    *pte = PTE_MKSWAP(v->v_slot) | (*pte & PTE_DIRTY);
+    vm_shootdown_add(sb, v->v_as, v->v_va);
+
+    *gotone = true;
+    return true;
+
+ skip:
+    if (v->v_locked) {
+        lock_release(v->v_as->as_lock);
+    }
+    return true;
+}
+
+/*
+ * Evict up to PAGEOUT_BATCH pages. Dirty pages that got consecutive
+ * slots go to disk in a single write.
+ */
+static
+unsigned
+pageout_evict(void)
+{
+    struct victim v[PAGEOUT_BATCH];
+    paddr_t pas[PAGEOUT_BATCH];
+    struct vm_shootdownbatch sb;
+    unsigned nv, tries, i, j;
+    bool gotone;
+    int result;
+
+    if (!swap_enabled()) {
+        return 0;
+    }
+
+    lock_acquire(pageout_biglock);
+
+    nv = 0;
+    vm_shootdown_begin(&sb);
+    for (tries = 0; nv < PAGEOUT_BATCH && tries < 4 * PAGEOUT_BATCH; ++tries) {
+        if (!pageout_pick(&v[nv], &gotone, &sb)) {
+            break;
+        }
+        if (gotone) {
+            nv++;
+        }
+    }
+
+    /* Nobody may write to the pages once we've started copying them. */
+    vm_shootdown_end(&sb);
+
+    for (i = 0; i < nv; i = j) {
+        if (!v[i].v_dirty) {
+            j = i + 1;
+            continue;
+        }
+        pas[0] = v[i].v_pa;
+        for (j = i + 1; j < nv; ++j) {
+            if (!v[j].v_dirty || v[j].v_slot != v[i].v_slot + (j - i)) {
+                break;
+            }
+            pas[j - i] = v[j].v_pa;
+        }
+        result = swap_write(v[i].v_slot, pas, j - i);
+        if (result) {
+            panic("pageout: writing to swap: %s\n", strerror(result));
+        }
+    }
+
+    for (i = 0; i < nv; ++i) {
+        vm_count(VMS_EVICTIONS);
+        if (v[i].v_dirty) {
+            vm_count(VMS_SWAPOUTS);
+        }
+        coremap_free_upage(v[i].v_pa);
+        if (v[i].v_locked) {
+            lock_release(v[i].v_as->as_lock);
+        }
+    }
+
+    lock_release(pageout_biglock);
+
+    return nv;
+}
+
+unsigned
+pageout_reclaim(void)
+{
+    unsigned n;
+
+    n = pagecache_reclaim(PAGEOUT_BATCH);
+    if (n > 0 || pageout_biglock == NULL) {
+        return n;
+    }
+    return pageout_evict();
+}
+
+void
+pageout_wakeup(void)
+{
+    if (pageout_wchan == NULL || coremap_freepages() >= PAGEOUT_LOWATER) {
+        return;
+    }
+
+    spinlock_acquire(&pageout_spinlock);
+    if (!pageout_wanted) {
+        pageout_wanted = true;
+        wchan_wakeone(pageout_wchan, &pageout_spinlock);
+    }
+    spinlock_release(&pageout_spinlock);
+}
+
+static
+void
+pageout_thread(void *unused1, unsigned long unused2)
+{
+    (void)unused1;
+    (void)unused2;
+
+    while (1) {
+        spinlock_acquire(&pageout_spinlock);
+        while (!pageout_wanted) {
+            wchan_sleep(pageout_wchan, &pageout_spinlock);
+        }
+        spinlock_release(&pageout_spinlock);
+
+        while (coremap_freepages() < PAGEOUT_HIWATER) {
+            if (pagecache_reclaim(PAGEOUT_BATCH) == 0 &&
+                pageout_evict() == 0) {
+                break;
+            }
+        }
+
+        /* Clear this last, so allocations in the meantime don't wake us. */
+        spinlock_acquire(&pageout_spinlock);
+        pageout_wanted = false;
+        spinlock_release(&pageout_spinlock);
+    }
+}
+
+void
+pageout_bootstrap(void)
+{
+    int result;
+
+    /* Compaction uses the lock even without swap. */
+    pageout_biglock = lock_create("pageout");
+    if (pageout_biglock == NULL) {
+        panic("pageout: out of memory\n");
+    }
+
+    if (!swap_enabled()) {
+        return;
+    }
+
+    pageout_wchan = wchan_create("pageout");
+    if (pageout_wchan == NULL) {
+        panic("pageout: out of memory\n");
+    }
+
+    result = thread_fork("pageout", NULL, pageout_thread, NULL, 0);
+    if (result) {
+        panic("pageout: thread_fork: %s\n", strerror(result));
+    }
+}
@@ -0,0 +1,93 @@
+#include <types.h>
+#include <lib.h>
+#include <vm.h>
+#include <pagetable.h>
+
+struct pagetable *
+pt_create(void)
+{
+    struct pagetable *pt;
+
+    pt = kmalloc(sizeof(*pt));
+    if (pt == NULL) {
+        return NULL;
+    }
+    bzero(pt, sizeof(*pt));
+
+    return pt;
+}
+
+void
+pt_destroy(struct pagetable *pt)
+{
+    KASSERT(pt != NULL);
+
+    for (unsigned i = 0; i < PT_NDIRS; ++i) {
+        if (pt->pt_dir[i] != NULL) {
+            kfree(pt->pt_dir[i]);
+        }
+    }
+    kfree(pt);
+}
+
+pte_t *
+pt_get(struct pagetable *pt, vaddr_t va, bool create)
+{
+    pte_t *leaf;
+
+    if (va >= USERSPACETOP) {
+        return NULL;
+    }
+
+    leaf = pt->pt_dir[PT_DIR(va)];
+    if (leaf == NULL) {
+        if (!create) {
+            return NULL;
+        }
+        leaf = kmalloc(PAGE_SIZE);
+        if (leaf == NULL) {
+            return NULL;
+        }
+        bzero(leaf, PAGE_SIZE);
+        pt->pt_dir[PT_DIR(va)] = leaf;
+    }
+
+    return &leaf[PT_INDEX(va)];
+}
+
+int
+pt_foreach(struct pagetable *pt, vaddr_t start, vaddr_t end,
+           int (*fn)(vaddr_t va, pte_t *pte, void *data), void *data)
+{
+    vaddr_t va;
+    pte_t *leaf;
+    int result;
+
+    KASSERT(start % PAGE_SIZE == 0);
+    if (end > USERSPACETOP) {
+        end = USERSPACETOP;
+    }
+
+    va = start;
+    while (va < end) {
+        leaf = pt->pt_dir[PT_DIR(va)];
+        if (leaf == NULL) {
+            /* Skip to the start of the next second-level table. */
+            va = ROUNDUP(va + 1, PT_SPAN);
+            continue;
+        }
+        if (leaf[PT_INDEX(va)] != 0) {
+            result = fn(va, &leaf[PT_INDEX(va)], data);
+            if (result) {
+                return result;
+            }
+        }
+        va += PAGE_SIZE;
+        if (va == 0) {
+            /* Wrapped around. */
+            break;
+        }
+    }
+
+    return 0;
+}
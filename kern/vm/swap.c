@@ -0,0 +1,259 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/iovec.h>
+#include <kern/stat.h>
+#include <lib.h>
+#include <bitmap.h>
+#include <spinlock.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <vm.h>
+#include <swap.h>
+#include <zswap.h>
+
+/*
+ * Swap slots.
+ *
+ * The bitmap says which slots are in use; the reference counts say
+ * how many page tables (or coremap entries, for clean pages) point at
+ * each one.
+ *
+ * Pages written out go to the compressed pool (zswap.c) if they'll
+ * fit and reach the disk only if they don't, or once the pool makes
+ * room for newer pages by writing back its oldest. Only pageout
+ * writes, so swap_bounce, the page those go through, needs no lock.
+ */
+
+static struct vnode *swap_vnode;    /* Raw swap device, or NULL. */
+static unsigned swap_nslots;
+static struct bitmap *swap_map;
+static uint16_t *swap_refs;
+static unsigned swap_nused;         /* Slots in use. */
+static struct spinlock swap_lock = SPINLOCK_INITIALIZER;
+static paddr_t swap_bounce;         /* For writing back from the pool. */
+
+bool
+swap_enabled(void)
+{
+    return swap_vnode != NULL;
+}
+
+/*
+ * Running without swap is fine, so errors are just reported.
+ */
+void
+swap_bootstrap(void)
+{
+    struct vnode *vn;
+    struct stat st;
+    vaddr_t bounce;
+    int result;
+
+    result = vfs_swapon(SWAP_DEVICE, &vn);
+    if (result) {
+        kprintf("swap: %s: %s; running without swap\n", SWAP_DEVICE,
+                strerror(result));
+        return;
+    }
+
+    result = VOP_STAT(vn, &st);
+    if (result || st.st_size < 2 * PAGE_SIZE) {
+        kprintf("swap: %s is unusable\n", SWAP_DEVICE);
+        vfs_swapoff(SWAP_DEVICE);
+        VOP_DECREF(vn);
+        return;
+    }
+
+    swap_nslots = st.st_size / PAGE_SIZE;
+    swap_map = bitmap_create(swap_nslots);
+    swap_refs = kmalloc(swap_nslots * sizeof(swap_refs[0]));
+    if (swap_map == NULL || swap_refs == NULL) {
+        panic("swap: out of memory for %u slots\n", swap_nslots);
+    }
+    bzero(swap_refs, swap_nslots * sizeof(swap_refs[0]));
+
+    /* Slot 0 means "no slot". */
+    bitmap_mark(swap_map, 0);
+
+    bounce = alloc_kpages(1);
+    if (bounce == 0) {
+        panic("swap: out of memory for the bounce page\n");
+    }
+    swap_bounce = KVADDR_TO_PADDR(bounce);
+    zswap_bootstrap(swap_nslots);
+
+    kprintf("swap: %u pages on %s\n", swap_nslots - 1, SWAP_DEVICE);
+    swap_vnode = vn;
+}
+
+unsigned
+swap_npages(void)
+{
+    return swap_vnode == NULL ? 0 : swap_nslots - 1;
+}
+
+unsigned
+swap_used(void)
+{
+    /* Unlocked read, like coremap_freepages. */
+    return swap_nused;
+}
+
+unsigned
+swap_alloc(void)
+{
+    unsigned slot;
+
+    if (swap_vnode == NULL) {
+        return 0;
+    }
+
+    spinlock_acquire(&swap_lock);
+    if (bitmap_alloc(swap_map, &slot)) {
+        spinlock_release(&swap_lock);
+        return 0;
+    }
+    KASSERT(swap_refs[slot] == 0);
+    swap_refs[slot] = 1;
+    swap_nused++;
+    spinlock_release(&swap_lock);
+
+    return slot;
+}
+
+void
+swap_share(unsigned slot)
+{
+    KASSERT(slot > 0 && slot < swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    KASSERT(swap_refs[slot] > 0 && swap_refs[slot] < 0xffff);
+    swap_refs[slot]++;
+    spinlock_release(&swap_lock);
+}
+
+void
+swap_free(unsigned slot)
+{
+    KASSERT(slot > 0 && slot < swap_nslots);
+
+    spinlock_acquire(&swap_lock);
+    KASSERT(swap_refs[slot] > 0);
+    if (--swap_refs[slot] > 0) {
+        spinlock_release(&swap_lock);
+        return;
+    }
+    spinlock_release(&swap_lock);
+
+    /* Before the slot can be handed out again. */
+    zswap_drop(slot);
+
+    spinlock_acquire(&swap_lock);
+    bitmap_unmark(swap_map, slot);
+    swap_nused--;
+    spinlock_release(&swap_lock);
+}
+
+unsigned
+swap_refcount(unsigned slot)
+{
+    KASSERT(slot > 0 && slot < swap_nslots);
+    return swap_refs[slot];
+}
+
+int
+swap_read(unsigned slot, paddr_t pa)
+{
+    struct iovec iov;
+    struct uio u;
+
+    KASSERT(slot > 0 && slot < swap_nslots);
+
+    if (zswap_load(slot, pa)) {
+        return 0;
+    }
+
+    uio_kinit(&iov, &u, (void *)PADDR_TO_KVADDR(pa), PAGE_SIZE,
+              (off_t)slot * PAGE_SIZE, UIO_READ);
+    return VOP_READ(swap_vnode, &u);
+}
+
+static
+int
+swap_writedisk(unsigned slot, const paddr_t *pas, unsigned n)
+{
+    struct iovec iov[PAGEOUT_BATCH];
+    struct uio u;
+
+    KASSERT(n > 0 && n <= PAGEOUT_BATCH);
+    KASSERT(slot > 0 && slot + n <= swap_nslots);
+
+    for (unsigned i = 0; i < n; ++i) {
+        iov[i].iov_kbase = (void *)PADDR_TO_KVADDR(pas[i]);
+        iov[i].iov_len = PAGE_SIZE;
+    }
+    u.uio_iov = iov;
+    u.uio_iovcnt = n;
+    u.uio_offset = (off_t)slot * PAGE_SIZE;
+    u.uio_resid = n * PAGE_SIZE;
+    u.uio_segflg = UIO_SYSSPACE;
+    u.uio_rw = UIO_WRITE;
+    u.uio_space = NULL;
+
+    return VOP_WRITE(swap_vnode, &u);
+}
+
+/*
+ * Put the page at PA in the pool for SLOT, writing back the pool's
+ * oldest pages to make room if need be. Returns false if the page
+ * has to go to disk after all.
+ */
+static
+bool
+swap_compress(unsigned slot, paddr_t pa)
+{
+    unsigned wslot;
+    int result;
+
+    result = zswap_store(slot, pa);
+    while (result == ENOSPC && zswap_evict(swap_bounce, &wslot)) {
+        result = swap_writedisk(wslot, &swap_bounce, 1);
+        if (result) {
+            panic("swap: writing back slot %u: %s\n", wslot,
+                  strerror(result));
+        }
+        zswap_forget(wslot);
+        result = zswap_store(slot, pa);
+    }
+    return result == 0;
+}
+
+int
+swap_write(unsigned slot, const paddr_t *pas, unsigned n)
+{
+    unsigned i, start;
+    int result;
+
+    KASSERT(n > 0 && n <= PAGEOUT_BATCH);
+    KASSERT(slot > 0 && slot + n <= swap_nslots);
+
+    /* Write whatever doesn't compress in runs of consecutive slots. */
+    start = 0;
+    for (i = 0; i < n; ++i) {
+        if (!swap_compress(slot + i, pas[i])) {
+            continue;
+        }
+        if (i > start) {
+            result = swap_writedisk(slot + start, pas + start, i - start);
+            if (result) {
+                return result;
+            }
+        }
+        start = i + 1;
+    }
+    if (n > start) {
+        return swap_writedisk(slot + start, pas + start, n - start);
+    }
+    return 0;
+}
@@ -0,0 +1,1080 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <cpu.h>
+#include <proc.h>
+#include <current.h>
+#include <synch.h>
+#include <uio.h>
+#include <vnode.h>
+#include <kern/vmstat.h>
+#include <mips/tlb.h>
+#include <platform/maxcpus.h>
+#include <addrspace.h>
+#include <vm.h>
+#include <coremap.h>
+#include <swap.h>
+#include <pagecache.h>
+#include <vmprivate.h>
+
+/*
+ * Demand-paged VM system.
+ *
+ * Each address space has a two-level page table and a list of regions.
+ * Nothing is allocated up front: the first touch of a page in a region
+ * faults. A read maps the shared zero page read-only (PTE_ZERO); a
+ * write, either then or later, allocates a zeroed page of its own.
+ *
+ * After fork, parent and child share their pages read-only with
+ * PTE_COW set. The first write to such a page copies it, unless
+ * nobody else is still using it, in which case it's just made
+ * writable again.
+ *
+ * Pages paged out by pageout.c are PTE_SWAPPED. A page read back in
+ * keeps its swap slot and is mapped read-only until it's written, so
+ * that if it stays clean it can be dropped again without a write.
+ */
+
+/*
+ * Each user translation is tagged with an address space ID, so
+ * switching address spaces just means loading a different one into
+ * EntryHi. There are only TLBHI_NPIDS IDs, so each CPU hands them out
+ * separately; the count of IDs handed out also carries a generation
+ * number above the ID, and when the IDs run out the CPU flushes its
+ * TLB and starts a new generation. An address space's ID on a CPU is
+ * only good if it's from that CPU's current generation. ID 0 is never
+ * used for user translations.
+ *
+ * The per-CPU state is only touched by its own CPU with interrupts
+ * off, except for vc_as, which says what the CPU is translating for.
+ * vc_lock protects vc_as and every address space's as_asid[] entry
+ * for the CPU: shootdowns from other CPUs look at vc_as to decide
+ * whether to interrupt the CPU, and if it isn't running the address
+ * space they just throw its ID away instead.
+ */
+#define ASID_MASK       (TLBHI_NPIDS - 1)
+
+struct vm_cpu {
+    unsigned vc_asidnext;           /* Last ID handed out, and generation. */
+    unsigned vc_asid;               /* ID currently in EntryHi. */
+    struct addrspace *vc_as;        /* Address space that ID belongs to. */
+    struct spinlock vc_lock;
+
+    uint32_t vc_counts[VMS_NCOUNTS];    /* Events; see <kern/vmstat.h>. */
+    unsigned vc_asidrollovers;      /* Times the IDs ran out. */
+
+    unsigned vc_faultarounds;       /* Faults that mapped pages ahead. */
+    unsigned vc_fapages;            /* Pages mapped ahead. */
+    unsigned vc_fahits;             /* ...that a sequential walk reached. */
+    unsigned vc_famisses;           /* ...that it didn't. */
+};
+
+static struct vm_cpu vm_cpus[MAXCPUS];
+
+/* The page every untouched anonymous page reads as. Never written. */
+static paddr_t vm_zeropage;
+
+void
+vm_bootstrap(void)
+{
+    vaddr_t kva;
+
+    /* The coremap is normally set up by the first alloc_kpages. */
+    coremap_bootstrap();
+
+    kva = alloc_kpages(1);
+    if (kva == 0) {
+        panic("vm: no memory for the zero page\n");
+    }
+    bzero((void *)kva, PAGE_SIZE);
+    vm_zeropage = KVADDR_TO_PADDR(kva);
+
+    /* vm_shootdown_add keeps a bitmask of CPUs. */
+    COMPILE_ASSERT(MAXCPUS <= 32);
+
+    /* Start every CPU in generation 1, so a zero as_asid is never good. */
+    for (unsigned i = 0; i < MAXCPUS; ++i) {
+        vm_cpus[i].vc_asidnext = TLBHI_NPIDS;
+        spinlock_init(&vm_cpus[i].vc_lock);
+    }
+
+    swap_bootstrap();
+    pageout_bootstrap();
+}
+
+/*
+ * Drop every translation from this CPU's TLB. Interrupts must be off.
+ */
+static
+void
+vm_tlbflush(struct vm_cpu *vc)
+{
+    for (int i = 0; i < NUM_TLB; ++i) {
+        tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+    }
+    tlb_setasid(vc->vc_asid);
+    vc->vc_counts[VMS_TLBFLUSHES]++;
+}
+
+/*
+ * Return AS's ID on this CPU, giving it a new one if it doesn't have
+ * a good one. Interrupts must be off.
+ */
+static
+unsigned
+vm_getasid(struct vm_cpu *vc, struct addrspace *as)
+{
+    unsigned *asid = &as->as_asid[curcpu->c_number];
+
+    if ((*asid & ~ASID_MASK) != (vc->vc_asidnext & ~ASID_MASK)) {
+        if ((++vc->vc_asidnext & ASID_MASK) == 0) {
+            /* Out of IDs. Nothing from the old generation may survive. */
+            vc->vc_asidnext++;
+            vc->vc_asidrollovers++;
+            vm_tlbflush(vc);
+        }
+        *asid = vc->vc_asidnext;
+    }
+    return *asid & ASID_MASK;
+}
+
+void
+vm_tlbactivate(struct addrspace *as)
+{
+    struct vm_cpu *vc;
+    int spl;
+
+    spl = splhigh();
+    vc = &vm_cpus[curcpu->c_number];
+    spinlock_acquire(&vc->vc_lock);
+    vc->vc_as = as;
+    vc->vc_asid = as == NULL ? 0 : vm_getasid(vc, as);
+    tlb_setasid(vc->vc_asid);
+    spinlock_release(&vc->vc_lock);
+    splx(spl);
+}
+
+void
+vm_tlbforget(struct addrspace *as)
+{
+    struct vm_cpu *vc;
+
+    for (unsigned i = 0; i < MAXCPUS; ++i) {
+        vc = &vm_cpus[i];
+        spinlock_acquire(&vc->vc_lock);
+        if (vc->vc_as == as) {
+            /* The ID stays in EntryHi; nothing user-level runs with it. */
+            vc->vc_as = NULL;
+        }
+        spinlock_release(&vc->vc_lock);
+    }
+}
+
+/*
+ * The TLB entry for VA mapped by PTE, for the current ID on this CPU.
+ */
+static
+void
+vm_tlbentry(struct vm_cpu *vc, vaddr_t va, pte_t pte,
+            uint32_t *ehi, uint32_t *elo)
+{
+    KASSERT(pte & PTE_PRESENT);
+    KASSERT(vc->vc_asid != 0);
+
+    *ehi = (va & TLBHI_VPAGE) | (vc->vc_asid << TLBHI_PIDSHIFT);
+    *elo = (pte & PTE_FRAME) | TLBLO_VALID;
+    if (pte & PTE_WRITE) {
+        *elo |= TLBLO_DIRTY;
+    }
+}
+
+/*
+ * Load a TLB entry, replacing the one for the same page if there is
+ * one and otherwise letting the processor pick a slot. Even after a
+ * miss there might be one: the faulting thread may have been moved to
+ * another CPU since. Interrupts must be off.
+ */
+static
+void
+vm_tlbput(uint32_t ehi, uint32_t elo)
+{
+    int index;
+
+    index = tlb_probe(ehi, 0);
+    if (index >= 0) {
+        tlb_write(ehi, elo, index);
+    }
+    else {
+        tlb_random(ehi, elo);
+    }
+}
+
+void
+vm_tlbload(vaddr_t va, pte_t pte)
+{
+    struct vm_cpu *vc;
+    uint32_t ehi, elo;
+    int spl;
+
+    /* Disable interrupts on this CPU while frobbing the TLB. */
+    spl = splhigh();
+    vc = &vm_cpus[curcpu->c_number];
+    vm_tlbentry(vc, va, pte, &ehi, &elo);
+    vm_tlbput(ehi, elo);
+    splx(spl);
+}
+
+/*
+ * Drop this CPU's translations for VA, or all of them if VA is
+ * TLBSHOOTDOWN_ALL, tagged with ASID (which includes its generation).
+ * Interrupts must be off.
+ */
+static
+void
+vm_tlbinvalidate(unsigned asid, vaddr_t va)
+{
+    struct vm_cpu *vc = &vm_cpus[curcpu->c_number];
+    uint32_t ehi, elo;
+    int index;
+
+    if ((asid & ~ASID_MASK) != (vc->vc_asidnext & ~ASID_MASK)) {
+        /* Nothing from an old generation is left in the TLB. */
+        return;
+    }
+    asid &= ASID_MASK;
+
+    if (va == TLBSHOOTDOWN_ALL) {
+        for (int i = 0; i < NUM_TLB; ++i) {
+            tlb_read(&ehi, &elo, i);
+            if ((ehi & TLBHI_PID) >> TLBHI_PIDSHIFT == asid) {
+                tlb_write(TLBHI_INVALID(i), TLBLO_INVALID(), i);
+            }
+        }
+    }
+    else {
+        ehi = (va & TLBHI_VPAGE) | (asid << TLBHI_PIDSHIFT);
+        index = tlb_probe(ehi, 0);
+        if (index >= 0) {
+            tlb_write(TLBHI_INVALID(index), TLBLO_INVALID(), index);
+        }
+    }
+    tlb_setasid(vc->vc_asid);
+}
+
+void
+vm_shootdown_begin(struct vm_shootdownbatch *sb)
+{
+    sb->sb_cpus = 0;
+}
+
+void
+vm_shootdown_add(struct vm_shootdownbatch *sb, struct addrspace *as,
+                 vaddr_t va)
+{
+    struct tlbshootdown ts;
+    struct vm_cpu *vc;
+    unsigned me;
+    int spl;
+
+    /* Stay on this CPU until we're done. */
+    spl = splhigh();
+    me = curcpu->c_number;
+
+    ts.ts_vaddr = va;
+    for (unsigned i = 0; i < num_cpus; ++i) {
+        vc = &vm_cpus[i];
+        spinlock_acquire(&vc->vc_lock);
+        ts.ts_asid = as->as_asid[i];
+        if (ts.ts_asid == 0) {
+            /* Never had an ID there, or already lost it. */
+        }
+        else if (vc->vc_as != as) {
+            /*
+             * Not running there, so rather than interrupt it, make
+             * AS get a new ID there next time. Nothing tagged with
+             * the old one can be used again.
+             */
+            as->as_asid[i] = 0;
+        }
+        else if (i == me) {
+            vm_tlbinvalidate(ts.ts_asid, va);
+        }
+        else {
+            ipi_tlbshootdown_queue(cpu_bynumber(i), &ts);
+            sb->sb_cpus |= (uint32_t)1 << i;
+        }
+        spinlock_release(&vc->vc_lock);
+    }
+
+    splx(spl);
+}
+
+void
+vm_shootdown_end(struct vm_shootdownbatch *sb)
+{
+    unsigned tickets[MAXCPUS];
+    unsigned i;
+
+    /* One interrupt per CPU, then wait for all of them. */
+    for (i = 0; i < num_cpus; ++i) {
+        if (sb->sb_cpus & ((uint32_t)1 << i)) {
+            tickets[i] = ipi_tlbshootdown_send(cpu_bynumber(i));
+        }
+    }
+    for (i = 0; i < num_cpus; ++i) {
+        if (sb->sb_cpus & ((uint32_t)1 << i)) {
+            ipi_tlbshootdown_wait(cpu_bynumber(i), tickets[i]);
+        }
+    }
+    sb->sb_cpus = 0;
+}
+
+void
+vm_shootdown(struct addrspace *as, vaddr_t va)
+{
+    struct vm_shootdownbatch sb;
+
+    vm_shootdown_begin(&sb);
+    vm_shootdown_add(&sb, as, va);
+    vm_shootdown_end(&sb);
+}
+
+void
+vm_tlbshootdown(const struct tlbshootdown *ts)
+{
+    int spl;
+
+    spl = splhigh();
+    if (ts == NULL) {
+        vm_tlbflush(&vm_cpus[curcpu->c_number]);
+    }
+    else {
+        vm_tlbinvalidate(ts->ts_asid, ts->ts_vaddr);
+    }
+    splx(spl);
+}
+
+/*
+ * Fast path for a TLB miss on a page that's already mapped: load the
+ * translation straight from the page table, without as_lock. Returns
+ * false if the fault needs the full treatment.
+ *
+ * This is safe without the lock because page table pages stay put
+ * until the address space is destroyed, and anyone changing a present
+ * PTE shoots down its translations afterwards; with interrupts off,
+ * that shootdown can't get in between reading the PTE and loading it.
+ */
+static
+bool
+vm_tlbrefill(struct addrspace *as, vaddr_t va, bool write)
+{
+    struct vm_cpu *vc;
+    pte_t *pte, p;
+    uint32_t ehi, elo;
+    int spl;
+
+    spl = splhigh();
+
+    pte = pt_get(as->as_pt, va, false);
+    p = pte == NULL ? 0 : *pte;
+    if (!(p & PTE_PRESENT) || (write && !(p & PTE_WRITE))) {
+        splx(spl);
+        return false;
+    }
+
+    vc = &vm_cpus[curcpu->c_number];
+    vm_tlbentry(vc, va, p, &ehi, &elo);
+    vm_tlbput(ehi, elo);
+    vc->vc_counts[VMS_TLBREFILLS]++;
+
+    if (!(p & PTE_ZERO)) {
+        coremap_touch(p & PTE_FRAME);
+    }
+
+    splx(spl);
+    return true;
+}
+
+/*
+ * Count a fault on this CPU.
+ */
+static
+void
+vm_countfault(int faulttype)
+{
+    struct vm_cpu *vc;
+    int spl;
+
+    spl = splhigh();
+    vc = &vm_cpus[curcpu->c_number];
+    if (faulttype == VM_FAULT_READONLY) {
+        vc->vc_counts[VMS_TLBMODS]++;
+    }
+    else {
+        vc->vc_counts[VMS_TLBMISSES]++;
+    }
+    splx(spl);
+}
+
+void
+vm_printtlbstats(void)
+{
+    struct vm_cpu *vc;
+    unsigned used;
+
+    kprintf("cpu   tlb misses   refills  tlb mods  flushes  "
+            "asid rollovers\n");
+    for (unsigned i = 0; i < num_cpus; ++i) {
+        vc = &vm_cpus[i];
+        kprintf("%3u %12u %9u %9u %8u %15u\n", i,
+                vc->vc_counts[VMS_TLBMISSES], vc->vc_counts[VMS_TLBREFILLS],
+                vc->vc_counts[VMS_TLBMODS], vc->vc_counts[VMS_TLBFLUSHES],
+                vc->vc_asidrollovers);
+    }
+
+    kprintf("\ncpu  fault-arounds  pages ahead      hits    misses  "
+            "hit rate\n");
+    for (unsigned i = 0; i < num_cpus; ++i) {
+        vc = &vm_cpus[i];
+        used = vc->vc_fahits + vc->vc_famisses;
+        kprintf("%3u %14u %12u %9u %9u %8u%%\n", i, vc->vc_faultarounds,
+                vc->vc_fapages, vc->vc_fahits, vc->vc_famisses,
+                used == 0 ? 0 : vc->vc_fahits * 100 / used);
+    }
+}
+
+void
+vm_count(unsigned event)
+{
+    int spl;
+
+    KASSERT(event < VMS_NCOUNTS);
+
+    spl = splhigh();
+    vm_cpus[curcpu->c_number].vc_counts[event]++;
+    splx(spl);
+}
+
+int
+vm_getstats(struct vmstat *vs)
+{
+    bzero(vs, sizeof(*vs));
+
+    /* Unlocked reads; each count was right at some point. */
+    for (unsigned i = 0; i < num_cpus; ++i) {
+        for (unsigned j = 0; j < VMS_NCOUNTS; ++j) {
+            vs->vs_counts[j] += vm_cpus[i].vc_counts[j];
+        }
+    }
+    vs->vs_npages = coremap_npages();
+    vs->vs_freepages = coremap_freepages();
+    vs->vs_swappages = swap_npages();
+    vs->vs_swapused = swap_used();
+    return 0;
+}
+
+bool
+vm_idle(void)
+{
+    return coremap_zeroidle();
+}
+
+/*
+ * Give VA the page *SPARE, zeroed unless ZEROED says it already is,
+ * replacing whatever PTE maps.
+ */
+static
+void
+vm_zerofill(struct addrspace *as, vaddr_t va, pte_t *pte, paddr_t *spare,
+            bool zeroed)
+{
+    bool wasmapped = (*pte & PTE_PRESENT) != 0;
+
+    KASSERT(!wasmapped || (*pte & PTE_ZERO));
+
+    if (!zeroed) {
+        bzero((void *)PADDR_TO_KVADDR(*spare), PAGE_SIZE);
+    }
+    vm_count(VMS_ZEROFILLS);
+    *pte = *spare | PTE_PRESENT | PTE_WRITE;
+    *spare = 0;
+
+    /* Other CPUs may still map the zero page here under a live ID. */
+    if (wasmapped) {
+        vm_shootdown(as, va);
+    }
+}
+
+/*
+ * Bring a page in from swap into *SPARE.
+ */
+static
+int
+vm_swapin(pte_t *pte, bool write, bool writable, paddr_t *spare)
+{
+    unsigned slot;
+    int result;
+
+    KASSERT(*pte & PTE_SWAPPED);
+
+    slot = PTE_SLOT(*pte);
+    result = swap_read(slot, *spare);
+    if (result) {
+        return result;
+    }
+    vm_count(VMS_SWAPINS);
+
+    if (write || swap_refcount(slot) > 1) {
+        /* It'll be dirty, or someone else still needs the slot. */
+        swap_free(slot);
+        *pte = *spare | PTE_PRESENT | (writable ? PTE_WRITE : 0) |
+               (*pte & PTE_DIRTY);
+    }
+    else {
+        /*
+         * Keep the slot so the page can be dropped again without
+         * writing it. Map it read-only to find out if it gets dirty.
+         */
+        coremap_setslot(*spare, slot);
+        *pte = *spare | PTE_PRESENT | (*pte & PTE_DIRTY);
+    }
+    *spare = 0;
+
+    return 0;
+}
+
+/*
+ * Whether the page at VA in RG is read in from RG's file, rather than
+ * zero-filled.
+ */
+static
+bool
+vm_fromfile(struct region *rg, vaddr_t va)
+{
+    return rg->rg_vnode != NULL && va - rg->rg_base < rg->rg_filesize;
+}
+
+/*
+ * How many bytes of the page at VA in RG come from RG's file.
+ */
+static
+size_t
+vm_filelen(struct region *rg, vaddr_t va)
+{
+    size_t len;
+
+    len = rg->rg_filesize - (va - rg->rg_base);
+    return len < PAGE_SIZE ? len : PAGE_SIZE;
+}
+
+/*
+ * Whether the page at VA in RG goes through the page cache: it has to
+ * be part of a program's text or read-only data, which never changes.
+ */
+static
+bool
+vm_cacheable(struct region *rg, vaddr_t va, bool writable)
+{
+    return !writable && !(rg->rg_flags & RGF_MMAP) && vm_fromfile(rg, va);
+}
+
+/*
+ * Map the page at VA in RG from the page cache, if it's there.
+ */
+static
+void
+vm_cachein(struct region *rg, vaddr_t va, pte_t *pte)
+{
+    paddr_t pa;
+
+    KASSERT(!(*pte & (PTE_PRESENT | PTE_SWAPPED)));
+
+    pa = pagecache_lookup(rg->rg_vnode, rg->rg_offset + (va - rg->rg_base),
+                          vm_filelen(rg, va));
+    if (pa != 0) {
+        *pte = pa | PTE_PRESENT;
+        vm_count(VMS_CACHEHITS);
+    }
+}
+
+/*
+ * Read the page at VA in file-backed region RG into *SPARE. A page of
+ * a shared mapping starts out read-only, so that the first write to
+ * it can mark it dirty. Cacheable pages go into the page cache, and
+ * if somebody else got one in first we use theirs and leave *SPARE.
+ */
+static
+int
+vm_filein(struct region *rg, vaddr_t va, pte_t *pte, bool write,
+          bool writable, paddr_t *spare)
+{
+    struct iovec iov;
+    struct uio u;
+    off_t offset;
+    size_t len;
+    paddr_t pa;
+    char *kva;
+    int result;
+
+    KASSERT(!(*pte & (PTE_PRESENT | PTE_SWAPPED)));
+    KASSERT(vm_fromfile(rg, va));
+
+    offset = rg->rg_offset + (va - rg->rg_base);
+    len = vm_filelen(rg, va);
+
+    kva = (char *)PADDR_TO_KVADDR(*spare);
+    uio_kinit(&iov, &u, kva, len, offset, UIO_READ);
+    result = VOP_READ(rg->rg_vnode, &u);
+    if (result) {
+        return result;
+    }
+    vm_count(VMS_FILEINS);
+
+    /* Past the end of the file, or of the region's part of it, is zeros. */
+    bzero(kva + len - u.uio_resid, PAGE_SIZE - len + u.uio_resid);
+
+    if (vm_cacheable(rg, va, writable)) {
+        pa = pagecache_insert(rg->rg_vnode, offset, len, *spare);
+        if (pa != *spare) {
+            *pte = pa | PTE_PRESENT;
+            return 0;
+        }
+    }
+
+    if (rg->rg_flags & RGF_SHARED) {
+        writable = writable && write;
+    }
+    *pte = *spare | PTE_PRESENT | (writable ? PTE_WRITE : 0);
+    *spare = 0;
+
+    return 0;
+}
+
+int
+vm_sharedin(struct addrspace *as, struct region *rg, vaddr_t va,
+            pte_t *pte, paddr_t *spare)
+{
+    KASSERT(rg->rg_flags & RGF_SHARED);
+
+    if (*pte & PTE_SWAPPED) {
+        return vm_swapin(pte, false, false, spare);
+    }
+    if (!(*pte & PTE_PRESENT) && vm_fromfile(rg, va)) {
+        return vm_filein(rg, va, pte, false, false, spare);
+    }
+    if (!(*pte & PTE_PRESENT) || (*pte & PTE_ZERO)) {
+        vm_zerofill(as, va, pte, spare, false);
+        *pte &= ~PTE_WRITE;
+    }
+    return 0;
+}
+
+/*
+ * A write to a page we've got to ourselves, or share through a shared
+ * mapping. Any copy in swap is now out of date. A shared page may be
+ * written for the first time in several address spaces at once, each
+ * under its own as_lock, so only the one that takes the slot frees it.
+ */
+static
+void
+vm_makedirty(struct addrspace *as, vaddr_t va, pte_t *pte)
+{
+    paddr_t pa = *pte & PTE_FRAME;
+    unsigned slot;
+
+    if (coremap_refcount(pa) == 1) {
+        coremap_claim(pa, as, va);
+    }
+    slot = coremap_takeslot(pa);
+    if (slot != 0) {
+        swap_free(slot);
+    }
+    *pte = (*pte & ~PTE_COW) | PTE_WRITE;
+}
+
+/*
+ * Handle a write to a copy-on-write page, copying it into *SPARE if
+ * it's still shared.
+ */
+static
+void
+vm_copyonwrite(struct addrspace *as, vaddr_t va, pte_t *pte, paddr_t *spare)
+{
+    paddr_t oldpa;
+
+    KASSERT(*pte & PTE_COW);
+
+    oldpa = *pte & PTE_FRAME;
+    if (coremap_refcount(oldpa) == 1) {
+        /* Everybody else has let go of it; it's ours. */
+        vm_makedirty(as, va, pte);
+        return;
+    }
+
+    KASSERT(*spare != 0);
+    vm_count(VMS_COPIES);
+    memmove((void *)PADDR_TO_KVADDR(*spare),
+            (const void *)PADDR_TO_KVADDR(oldpa), PAGE_SIZE);
+    *pte = *spare | (*pte & ~(PTE_FRAME | PTE_COW)) | PTE_WRITE;
+    *spare = 0;
+
+    /* Nobody may keep reading the old frame once it can be freed. */
+    vm_shootdown(as, va);
+    coremap_free_upage(oldpa);
+}
+
+/*
+ * Whether handling this fault will need a fresh page.
+ */
+static
+bool
+vm_needpage(struct region *rg, vaddr_t va, pte_t pte, bool write)
+{
+    if (pte & PTE_SWAPPED) {
+        return true;
+    }
+    if (!(pte & PTE_PRESENT) && vm_fromfile(rg, va)) {
+        return true;
+    }
+    if (!write) {
+        return false;
+    }
+    if (!(pte & PTE_PRESENT) || (pte & PTE_ZERO)) {
+        return true;
+    }
+    return (pte & PTE_COW) && coremap_refcount(pte & PTE_FRAME) > 1;
+}
+
+/*
+ * Fault-around. A slow fault on the page right after the ones the last
+ * fault in the same region mapped means the program is walking
+ * through the region, so map the next few pages in the same fault,
+ * twice as many each time the walk keeps going, up to VM_FAULTAROUND
+ * in all. A fault anywhere else starts over at one page.
+ *
+ * Pages mapped ahead count as hits if the walk goes on past them and
+ * misses otherwise.
+ */
+#define VM_FAULTAROUND  8
+
+/*
+ * How many pages, starting at VA, a fault at VA should map.
+ */
+static
+unsigned
+vm_faultwindow(struct region *rg, vaddr_t va)
+{
+    unsigned window, left;
+
+    if (va != rg->rg_fanext) {
+        return 1;
+    }
+    window = rg->rg_fawindow * 2;
+    if (window > VM_FAULTAROUND) {
+        window = VM_FAULTAROUND;
+    }
+    left = (rg->rg_base + rg->rg_npages * PAGE_SIZE - va) / PAGE_SIZE;
+    return window < left ? window : left;
+}
+
+/*
+ * Whether the page a fault at VA needs (if any) should come zeroed:
+ * it's anonymous memory being written for the first time. PTE may be
+ * NULL if there's no page table for VA yet.
+ */
+static
+bool
+vm_needzeroed(struct region *rg, vaddr_t va, pte_t *pte, bool write)
+{
+    if (!write || vm_fromfile(rg, va)) {
+        return false;
+    }
+    if (pte == NULL) {
+        return true;
+    }
+    if (*pte & PTE_SWAPPED) {
+        return false;
+    }
+    return !(*pte & PTE_PRESENT) || (*pte & PTE_ZERO);
+}
+
+/*
+ * Whether mapping the page at VA, with PTE (NULL if it has no page
+ * table yet), ahead of time would take a fresh page.
+ */
+static
+bool
+vm_aheadneedpage(struct region *rg, vaddr_t va, pte_t *pte, bool write)
+{
+    if (pte != NULL && (*pte & (PTE_PRESENT | PTE_SWAPPED))) {
+        return false;
+    }
+    return vm_fromfile(rg, va) || write;
+}
+
+/*
+ * Map the pages after VA in a window of WINDOW, using SPARES[i] for
+ * the i'th, and load them into the TLB. Stop at the first page that
+ * can't be mapped cheaply: one in swap, one that needs copying or
+ * dirtying before it can be written, or one we didn't get a page for.
+ * Returns the number of pages mapped.
+ */
+static
+unsigned
+vm_faultahead(struct addrspace *as, struct region *rg, vaddr_t va,
+              unsigned window, bool write, bool writable, paddr_t *spares,
+              const bool *zeroed)
+{
+    vaddr_t ava;
+    pte_t *pte;
+    unsigned i;
+
+    for (i = 1; i < window; ++i) {
+        ava = va + i * PAGE_SIZE;
+        pte = pt_get(as->as_pt, ava, true);
+        if (pte == NULL || (*pte & PTE_SWAPPED)) {
+            break;
+        }
+        if (!(*pte & PTE_PRESENT) && vm_cacheable(rg, ava, writable)) {
+            vm_cachein(rg, ava, pte);
+        }
+        if (!(*pte & PTE_PRESENT)) {
+            if (vm_fromfile(rg, ava)) {
+                /* As if read, so a shared page stays clean. */
+                if (spares[i] == 0 ||
+                    vm_filein(rg, ava, pte, false, writable, &spares[i])) {
+                    break;
+                }
+            }
+            else if (write) {
+                if (spares[i] == 0) {
+                    break;
+                }
+                vm_zerofill(as, ava, pte, &spares[i], zeroed[i]);
+            }
+            else {
+                *pte = vm_zeropage | PTE_PRESENT | PTE_ZERO;
+                vm_count(VMS_ZEROMAPS);
+            }
+        }
+        else if (write && !(*pte & PTE_WRITE)) {
+            break;
+        }
+
+        /* Not marked referenced; that's up to the program. */
+        vm_tlbload(ava, *pte);
+    }
+
+    return i - 1;
+}
+
+/*
+ * Record a fault at VA that mapped AHEAD pages after it, in a window
+ * of WINDOW.
+ */
+static
+void
+vm_faultdone(struct region *rg, vaddr_t va, unsigned window, unsigned ahead)
+{
+    struct vm_cpu *vc;
+    int spl;
+
+    spl = splhigh();
+    vc = &vm_cpus[curcpu->c_number];
+    if (va == rg->rg_fanext) {
+        vc->vc_fahits += rg->rg_faahead;
+    }
+    else {
+        vc->vc_famisses += rg->rg_faahead;
+    }
+    if (ahead > 0) {
+        vc->vc_faultarounds++;
+        vc->vc_fapages += ahead;
+    }
+    splx(spl);
+
+    rg->rg_fawindow = window;
+    rg->rg_faahead = ahead;
+    rg->rg_fanext = va + (ahead + 1) * PAGE_SIZE;
+}
+
+int
+vm_fault(int faulttype, vaddr_t faultaddress)
+{
+    struct addrspace *as;
+    struct region *rg;
+    pte_t *pte, *apte;
+    paddr_t spares[VM_FAULTAROUND];
+    bool need[VM_FAULTAROUND], zero[VM_FAULTAROUND];
+    bool zeroed[VM_FAULTAROUND];    /* spares[i] is already zero-filled. */
+    unsigned window, ahead, nneed, i;
+    bool write, writable, triedahead;
+    int result;
+
+    faultaddress &= PAGE_FRAME;
+
+    switch (faulttype) {
+        case VM_FAULT_READ:
+        case VM_FAULT_WRITE:
+        case VM_FAULT_READONLY:
+            break;
+        default:
+            return EINVAL;
+    }
+    write = faulttype != VM_FAULT_READ;
+    vm_countfault(faulttype);
+
+    if (curproc == NULL) {
+        /* Probably a kernel fault early in boot; don't loop on it. */
+        return EFAULT;
+    }
+
+    as = proc_getas();
+    if (as == NULL) {
+        return EFAULT;
+    }
+
+    if (faulttype != VM_FAULT_READONLY &&
+        vm_tlbrefill(as, faultaddress, write)) {
+        return 0;
+    }
+    vm_count(VMS_FAULTS);
+
+    /*
+     * Pages can't be allocated with as_lock held, because getting one
+     * may mean paging out and that needs other address spaces' locks.
+     * So if we need one, let go, get one, and look again.
+     */
+    for (i = 0; i < VM_FAULTAROUND; ++i) {
+        spares[i] = 0;
+        zeroed[i] = false;
+    }
+    triedahead = false;
+ again:
+    lock_acquire(as->as_lock);
+
+    rg = as_findregion(as, faultaddress);
+    if (rg == NULL) {
+        result = EFAULT;
+        goto out;
+    }
+
+    /* load_elf writes the text segment, so allow writes while loading. */
+    writable = (rg->rg_perms & RG_WRITE) || as->as_loading;
+    if (write && !writable) {
+        result = EFAULT;
+        goto out;
+    }
+
+    pte = pt_get(as->as_pt, faultaddress, true);
+    if (pte == NULL) {
+        result = ENOMEM;
+        goto out;
+    }
+
+    /* Text somebody else has already read in needs no page. */
+    if (!(*pte & (PTE_PRESENT | PTE_SWAPPED)) &&
+        vm_cacheable(rg, faultaddress, writable)) {
+        vm_cachein(rg, faultaddress, pte);
+    }
+
+    /*
+     * Pages ahead are only worth getting once, and only if there's
+     * plenty of memory.
+     */
+    window = vm_faultwindow(rg, faultaddress);
+    need[0] = spares[0] == 0 && vm_needpage(rg, faultaddress, *pte, write);
+    zero[0] = vm_needzeroed(rg, faultaddress, pte, write);
+    nneed = need[0];
+    for (i = 1; i < window; ++i) {
+        apte = pt_get(as->as_pt, faultaddress + i * PAGE_SIZE, false);
+        need[i] = !triedahead && spares[i] == 0 &&
+            coremap_freepages() > PAGEOUT_HIWATER &&
+            vm_aheadneedpage(rg, faultaddress + i * PAGE_SIZE, apte, write);
+        zero[i] = vm_needzeroed(rg, faultaddress + i * PAGE_SIZE, apte, write);
+        nneed += need[i];
+    }
+    if (nneed > 0) {
+        lock_release(as->as_lock);
+        for (i = 0; i < window; ++i) {
+            if (!need[i]) {
+                continue;
+            }
+            if (zero[i]) {
+                spares[i] = coremap_alloc_zeroed_upage(as,
+                                            faultaddress + i * PAGE_SIZE);
+            }
+            else {
+                spares[i] = coremap_alloc_upage(as,
+                                            faultaddress + i * PAGE_SIZE);
+            }
+            zeroed[i] = zero[i];
+            if (spares[i] == 0 && i == 0) {
+                result = ENOMEM;
+                goto freespares;
+            }
+        }
+        triedahead = true;
+        goto again;
+    }
+
+    if (*pte & PTE_SWAPPED) {
+        result = vm_swapin(pte, write, writable, &spares[0]);
+        if (result) {
+            goto out;
+        }
+    }
+    else if (!(*pte & PTE_PRESENT) && vm_fromfile(rg, faultaddress)) {
+        result = vm_filein(rg, faultaddress, pte, write, writable, &spares[0]);
+        if (result) {
+            goto out;
+        }
+    }
+    else if (!(*pte & PTE_PRESENT) && !write) {
+        /* First touch is a read: it can share the zero page. */
+        *pte = vm_zeropage | PTE_PRESENT | PTE_ZERO;
+        vm_count(VMS_ZEROMAPS);
+    }
+    else if (!(*pte & PTE_PRESENT) || (*pte & PTE_ZERO)) {
+        /* First write: now it needs a page of its own. */
+        KASSERT(write);
+        vm_zerofill(as, faultaddress, pte, &spares[0], zeroed[0]);
+    }
+    else if (write && !(*pte & PTE_WRITE)) {
+        if (*pte & PTE_COW) {
+            vm_copyonwrite(as, faultaddress, pte, &spares[0]);
+        }
+        else {
+            /* A clean page from swap or a file, in a writable region. */
+            vm_makedirty(as, faultaddress, pte);
+        }
+    }
+
+    if (write && (rg->rg_flags & RGF_SHARED)) {
+        /* Now it needs writing back to the file. */
+        *pte |= PTE_DIRTY;
+    }
+
+    if (!(*pte & PTE_ZERO)) {
+        coremap_touch(*pte & PTE_FRAME);
+    }
+    vm_tlbload(faultaddress, *pte);
+
+    ahead = vm_faultahead(as, rg, faultaddress, window, write, writable,
+                          spares, zeroed);
+    vm_faultdone(rg, faultaddress, window, ahead);
+    result = 0;
+
+ out:
+    lock_release(as->as_lock);
+ freespares:
+    for (i = 0; i < VM_FAULTAROUND; ++i) {
+        if (spares[i] != 0) {
+            /* Somebody beat us to it, or it didn't need one after all. */
+            coremap_free_upage(spares[i]);
+        }
+    }
+    return result;
+}
@@ -0,0 +1,355 @@
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <synch.h>
+#include <vm.h>
+#include <coremap.h>
+#include <zswap.h>
+
+/*
+ * Compressed swap cache.
+ *
+ * The compressor is a small LZ77: a 3-byte hash finds an earlier
+ * occurrence of the next bytes in the page, and the output is groups
+ * of up to 8 items, each group led by a byte whose bit i is set if
+ * item i is a match. A literal is one byte. A match is two bytes, 12
+ * bits of offset-1 and 4 of length-3; 15 means the next byte holds
+ * the rest of the length. Offsets always fit, since they can't reach
+ * outside the page.
+ *
+ * Everything here is under zs_lock, including the compressor's
+ * scratch space, so pages compress one at a time.
+ */
+
+#define ZS_HASHBITS     12
+#define ZS_HASHSIZE     (1 << ZS_HASHBITS)
+#define ZS_MINMATCH     3
+#define ZS_MAXMATCH     (ZS_MINMATCH + 15 + 255)
+
+#define ZS_HASH(p) \
+    ((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * \
+      2654435761U) >> (32 - ZS_HASHBITS))
+
+struct zs_entry {
+    unsigned ze_slot;
+    unsigned ze_len;                /* Bytes in ze_data. */
+    bool ze_writing;                /* Being written back to disk. */
+    struct zs_entry *ze_prev;       /* Pool, oldest first. */
+    struct zs_entry *ze_next;
+    uint8_t ze_data[];
+};
+
+/* Entries fit kmalloc's largest subpage block instead of taking a page. */
+#define ZS_MAXLEN       (PAGE_SIZE / 2 - sizeof(struct zs_entry))
+
+static struct lock *zs_lock;
+static struct zs_entry **zs_slots;  /* By slot, or NULL. */
+static unsigned zs_nslots;
+static struct zs_entry *zs_oldest;
+static struct zs_entry *zs_newest;
+static size_t zs_maxbytes;
+
+static uint16_t zs_hash[ZS_HASHSIZE];   /* Position + 1, or 0. */
+static uint8_t zs_buf[PAGE_SIZE / 2];
+
+/* Counters, under zs_lock. */
+static unsigned zs_npages;          /* Pages in the pool. */
+static size_t zs_bytes;             /* Memory they take, headers included. */
+static unsigned zs_stored;          /* Disk writes avoided. */
+static unsigned zs_loads;
+static unsigned zs_writebacks;
+static unsigned zs_rejected;        /* Didn't compress well enough. */
+
+/*
+ * Compress the page at SRC into DST. Returns the length, or 0 if it's
+ * more than MAX bytes.
+ */
+static
+size_t
+zs_compress(const uint8_t *src, uint8_t *dst, size_t max)
+{
+    size_t ip, op, flagpos, len, cand, off;
+    unsigned nitems, h;
+
+    bzero(zs_hash, sizeof(zs_hash));
+
+    ip = op = flagpos = 0;
+    nitems = 8;
+    while (ip < PAGE_SIZE) {
+        if (nitems == 8) {
+            if (op >= max) {
+                return 0;
+            }
+            flagpos = op++;
+            dst[flagpos] = 0;
+            nitems = 0;
+        }
+
+        len = 0;
+        cand = 0;
+        if (ip + ZS_MINMATCH <= PAGE_SIZE) {
+            h = ZS_HASH(src + ip);
+            cand = zs_hash[h];
+            zs_hash[h] = ip + 1;
+            if (cand != 0) {
+                cand--;
+                while (ip + len < PAGE_SIZE && len < ZS_MAXMATCH &&
+                       src[cand + len] == src[ip + len]) {
+                    len++;
+                }
+            }
+        }
+
+        if (len >= ZS_MINMATCH) {
+            off = ip - cand - 1;
+            len -= ZS_MINMATCH;
+            if (op + (len >= 15 ? 3 : 2) > max) {
+                return 0;
+            }
+            dst[op++] = off >> 4;
+            dst[op++] = (off & 0xf) << 4 | (len >= 15 ? 15 : len);
+            if (len >= 15) {
+                dst[op++] = len - 15;
+            }
+            dst[flagpos] |= 1 << nitems;
+            ip += len + ZS_MINMATCH;
+        }
+        else {
+            if (op >= max) {
+                return 0;
+            }
+            dst[op++] = src[ip++];
+        }
+        nitems++;
+    }
+    return op;
+}
+
+static
+void
+zs_decompress(const uint8_t *src, size_t srclen, uint8_t *dst)
+{
+    size_t ip, op, off, len;
+    unsigned flags;
+
+    ip = op = 0;
+    while (op < PAGE_SIZE) {
+        KASSERT(ip < srclen);
+        flags = src[ip++];
+        for (unsigned i = 0; i < 8 && op < PAGE_SIZE; ++i) {
+            if (flags & (1 << i)) {
+                KASSERT(ip + 2 <= srclen);
+                off = ((size_t)src[ip] << 4 | src[ip + 1] >> 4) + 1;
+                len = (src[ip + 1] & 0xf) + ZS_MINMATCH;
+                ip += 2;
+                if (len == ZS_MINMATCH + 15) {
+                    KASSERT(ip < srclen);
+                    len += src[ip++];
+                }
+                KASSERT(off <= op && op + len <= PAGE_SIZE);
+                /* Byte at a time: the match may overlap itself. */
+                for (; len > 0; --len, ++op) {
+                    dst[op] = dst[op - off];
+                }
+            }
+            else {
+                KASSERT(ip < srclen);
+                dst[op++] = src[ip++];
+            }
+        }
+    }
+    KASSERT(ip == srclen);
+}
+
+static
+void
+zs_unlink(struct zs_entry *ze)
+{
+    if (ze->ze_prev != NULL) {
+        ze->ze_prev->ze_next = ze->ze_next;
+    }
+    else {
+        zs_oldest = ze->ze_next;
+    }
+    if (ze->ze_next != NULL) {
+        ze->ze_next->ze_prev = ze->ze_prev;
+    }
+    else {
+        zs_newest = ze->ze_prev;
+    }
+}
+
+static
+void
+zs_append(struct zs_entry *ze)
+{
+    ze->ze_prev = zs_newest;
+    ze->ze_next = NULL;
+    if (zs_newest != NULL) {
+        zs_newest->ze_next = ze;
+    }
+    else {
+        zs_oldest = ze;
+    }
+    zs_newest = ze;
+}
+
+static
+void
+zs_remove(struct zs_entry *ze)
+{
+    KASSERT(zs_slots[ze->ze_slot] == ze);
+
+    zs_unlink(ze);
+    zs_slots[ze->ze_slot] = NULL;
+    zs_npages--;
+    zs_bytes -= sizeof(*ze) + ze->ze_len;
+    kfree(ze);
+}
+
+void
+zswap_bootstrap(unsigned nslots)
+{
+    zs_lock = lock_create("zswap");
+    zs_slots = kmalloc(nslots * sizeof(zs_slots[0]));
+    if (zs_lock == NULL || zs_slots == NULL) {
+        panic("zswap: out of memory\n");
+    }
+    bzero(zs_slots, nslots * sizeof(zs_slots[0]));
+    zs_nslots = nslots;
+    zs_maxbytes = coremap_npages() / ZSWAP_FRACTION * PAGE_SIZE;
+}
+
+int
+zswap_store(unsigned slot, paddr_t pa)
+{
+    struct zs_entry *ze;
+    size_t len;
+
+    KASSERT(slot > 0 && slot < zs_nslots);
+
+    lock_acquire(zs_lock);
+    KASSERT(zs_slots[slot] == NULL);
+
+    len = zs_compress((const uint8_t *)PADDR_TO_KVADDR(pa), zs_buf,
+                      ZS_MAXLEN);
+    if (len == 0) {
+        zs_rejected++;
+        lock_release(zs_lock);
+        return EFBIG;
+    }
+    if (zs_bytes + sizeof(*ze) + len > zs_maxbytes) {
+        lock_release(zs_lock);
+        return ENOSPC;
+    }
+
+    ze = kmalloc(sizeof(*ze) + len);
+    if (ze == NULL) {
+        lock_release(zs_lock);
+        return ENOMEM;
+    }
+    ze->ze_slot = slot;
+    ze->ze_len = len;
+    ze->ze_writing = false;
+    memcpy(ze->ze_data, zs_buf, len);
+
+    zs_append(ze);
+    zs_slots[slot] = ze;
+    zs_npages++;
+    zs_bytes += sizeof(*ze) + len;
+    zs_stored++;
+    lock_release(zs_lock);
+
+    return 0;
+}
+
+bool
+zswap_load(unsigned slot, paddr_t pa)
+{
+    struct zs_entry *ze;
+
+    KASSERT(slot > 0 && slot < zs_nslots);
+
+    lock_acquire(zs_lock);
+    ze = zs_slots[slot];
+    if (ze == NULL) {
+        lock_release(zs_lock);
+        return false;
+    }
+    zs_decompress(ze->ze_data, ze->ze_len, (uint8_t *)PADDR_TO_KVADDR(pa));
+    zs_loads++;
+    lock_release(zs_lock);
+
+    return true;
+}
+
+void
+zswap_drop(unsigned slot)
+{
+    KASSERT(slot > 0 && slot < zs_nslots);
+
+    lock_acquire(zs_lock);
+    if (zs_slots[slot] != NULL) {
+        zs_remove(zs_slots[slot]);
+    }
+    lock_release(zs_lock);
+}
+
+bool
+zswap_evict(paddr_t pa, unsigned *slot)
+{
+    struct zs_entry *ze;
+
+    lock_acquire(zs_lock);
+    for (ze = zs_oldest; ze != NULL && ze->ze_writing; ze = ze->ze_next) {
+        /* nothing */
+    }
+    if (ze == NULL) {
+        lock_release(zs_lock);
+        return false;
+    }
+    zs_decompress(ze->ze_data, ze->ze_len, (uint8_t *)PADDR_TO_KVADDR(pa));
+    ze->ze_writing = true;
+    *slot = ze->ze_slot;
+    lock_release(zs_lock);
+
+    return true;
+}
+
+void
+zswap_forget(unsigned slot)
+{
+    struct zs_entry *ze;
+
+    KASSERT(slot > 0 && slot < zs_nslots);
+
+    lock_acquire(zs_lock);
+    ze = zs_slots[slot];
+    /* The slot may have been freed while we were writing it. */
+    if (ze != NULL && ze->ze_writing) {
+        zs_remove(ze);
+        zs_writebacks++;
+    }
+    lock_release(zs_lock);
+}
+
+void
+zswap_printstats(void)
+{
+    unsigned ratio;
+
+    if (zs_lock == NULL) {
+        kprintf("zswap: no swap\n");
+        return;
+    }
+
+    lock_acquire(zs_lock);
+    ratio = zs_bytes == 0 ? 0 :
+        (uint64_t)zs_npages * PAGE_SIZE * 100 / zs_bytes;
+    kprintf("zswap: %u pages in %u of %u bytes (ratio %u.%02u), "
+            "%u disk writes avoided, %u written back, %u loads, "
+            "%u incompressible\n", zs_npages, zs_bytes, zs_maxbytes,
+            ratio / 100, ratio % 100, zs_stored - zs_writebacks,
+            zs_writebacks, zs_loads, zs_rejected);
+    lock_release(zs_lock);
+}
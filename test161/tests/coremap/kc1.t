@@ -0,0 +1,9 @@
+---
+name: "Object Cache Test"
+description: >
+  Tests the typed object caches by checking exact-size packing and that
+  constructors run once per object rather than once per allocation.
+tags: [coremap]
+depends: [boot]
+---
+| kc1
@@ -0,0 +1,12 @@
+---
+name: "kfree Scaling Test"
+description: >
+  Times kfree on heaps with an increasing number of live subpage pages, and
+  fails if freeing on the largest heap is more than 3 times slower than on
+  the smallest.
+tags: [coremap]
+depends: [not-dumbvm.t]
+sys161:
+  ram: 16M
+---
+| km6 2000
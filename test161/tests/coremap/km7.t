@@ -0,0 +1,11 @@
+---
+name: "Large Kernel Heap Test"
+description: >
+  Fills most of memory with subpage allocations, more heap pages than the
+  old static pageref table could manage, and frees them again.
+tags: [coremap]
+depends: [not-dumbvm.t]
+sys161:
+  ram: 32M
+---
+| km7 5000
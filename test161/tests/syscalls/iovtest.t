@@ -0,0 +1,12 @@
+---
+name: "readv and writev Test"
+description: >
+  Writes a file with one writev and reads it back into differently split
+  buffers with one readv, checking the contents, byte counts and file
+  offset, and that bad iovec counts are rejected.
+tags: [filesyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 1M
+---
+$ /testbin/iovtest
@@ -0,0 +1,12 @@
+---
+name: "pread and pwrite Test"
+description: >
+  Writes a file of numbered blocks with pwrite, then has four processes
+  sharing one descriptor pread blocks at random offsets and check every
+  block they get.
+tags: [filesyscalls,syscalls]
+depends: [shell]
+sys161:
+  ram: 2M
+---
+$ /testbin/preadbench 4
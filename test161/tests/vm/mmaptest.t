@@ -0,0 +1,12 @@
+---
+name: "mmap Test"
+description: >
+  Maps a file shared and private, and anonymous memory, and checks
+  that changes to the shared mapping reach the file on msync and
+  munmap, and that a child's writes to it are seen by its parent.
+tags: [vm]
+depends: [not-dumbvm-vm, shell]
+sys161:
+  ram: 2M
+---
+$ /testbin/mmaptest
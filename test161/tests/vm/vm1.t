@@ -0,0 +1,12 @@
+---
+name: "sbrk Heap Test"
+description: >
+  Grows and shrinks a heap from inside the kernel, checking that pages
+  are only allocated when touched and are freed as soon as the heap
+  shrinks.
+tags: [vm]
+depends: [not-dumbvm]
+sys161:
+  ram: 4M
+---
+| vm1
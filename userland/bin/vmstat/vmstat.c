@@ -0,0 +1,90 @@
+/*
+ * vmstat - report VM statistics
+ * usage: vmstat [seconds [count]]
+ *
+ * Prints a line of event counts since boot, then, given an interval,
+ * a line of what happened in each interval: faults handled in full,
+ * TLB refills, zero-filled pages, copy-on-write copies, pages read
+ * from files and from swap, pages written to swap, pages evicted,
+ * pages allocated and freed, and the free memory and swap in use (in
+ * pages) at the end of the interval. Without a count it runs until
+ * killed.
+ *
+ * This program uses these system calls:
+ *    vmstat nanosleep write _exit
+ */
+
+#include <sys/vmstat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <err.h>
+
+static
+void
+print(const struct vmstat *vs, const struct vmstat *prev)
+{
+	unsigned d[VMS_NCOUNTS];
+	unsigned i;
+
+	for (i=0; i<VMS_NCOUNTS; i++) {
+		d[i] = vs->vs_counts[i] - (prev == NULL ? 0 :
+					   prev->vs_counts[i]);
+	}
+	printf("%7u %6u %6u %5u %6u %6u %6u %6u %6u %6u %7u %7u\n",
+	       d[VMS_FAULTS], d[VMS_TLBREFILLS], d[VMS_ZEROFILLS],
+	       d[VMS_COPIES], d[VMS_FILEINS], d[VMS_SWAPINS],
+	       d[VMS_SWAPOUTS], d[VMS_EVICTIONS], d[VMS_PAGEALLOCS],
+	       d[VMS_PAGEFREES], vs->vs_freepages, vs->vs_swapused);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct vmstat vs, prev;
+	struct timespec ts;
+	int interval, count;
+
+	interval = 0;
+	count = -1;
+	if (argc > 3) {
+		errx(1, "Usage: vmstat [seconds [count]]");
+	}
+	if (argc > 1) {
+		interval = atoi(argv[1]);
+		if (interval <= 0) {
+			errx(1, "bad interval %s", argv[1]);
+		}
+	}
+	if (argc > 2) {
+		count = atoi(argv[2]);
+		if (count <= 0) {
+			errx(1, "bad count %s", argv[2]);
+		}
+	}
+
+	if (vmstat(&vs) < 0) {
+		err(1, "vmstat");
+	}
+	printf(" faults refill  zfill   cow filein  swpin swpout  evict "
+	       " alloc   free freepgs swpused\n");
+	print(&vs, NULL);
+
+	ts.tv_sec = interval;
+	ts.tv_nsec = 0;
+	while (interval > 0 && count != 1) {
+		if (nanosleep(&ts, NULL) < 0) {
+			err(1, "nanosleep");
+		}
+		prev = vs;
+		if (vmstat(&vs) < 0) {
+			err(1, "vmstat");
+		}
+		print(&vs, &prev);
+		if (count > 0) {
+			count--;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _SYS_VMSTAT_H_
+#define _SYS_VMSTAT_H_
+
+#include <sys/types.h>
+#include <kern/vmstat.h>
+
+int vmstat(struct vmstat *buf);
+
+#endif /* _SYS_VMSTAT_H_ */
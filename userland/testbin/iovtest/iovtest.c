@@ -0,0 +1,121 @@
+/*
+ * iovtest.c
+ *
+ * Writes a header and a body to a file with one writev, reads them
+ * back into differently split buffers with one readv, and checks the
+ * contents, the byte counts and the file offset. Also checks that bad
+ * iovec counts are rejected.
+ */
+
+#include <sys/uio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define HDRSIZE         16
+#define BODYSIZE        5000        /* Crosses a block boundary. */
+#define TOTAL           (HDRSIZE + BODYSIZE)
+#define FILENAME        "iovtest.dat"
+
+static char hdr[HDRSIZE];
+static char body[BODYSIZE];
+static char in[3][TOTAL / 3 + 1];
+
+static
+char
+pattern(unsigned i)
+{
+	return (char)(i * 13 + 5);
+}
+
+static
+void
+fail(const char *msg)
+{
+	success(TEST161_FAIL, SECRET, "/testbin/iovtest");
+	errx(1, "FAILED: %s", msg);
+}
+
+int
+main(void)
+{
+	struct iovec iov[4];
+	ssize_t len;
+	unsigned i, j, k;
+	int fd;
+
+	for (i = 0; i < HDRSIZE; i++) {
+		hdr[i] = pattern(i);
+	}
+	for (i = 0; i < BODYSIZE; i++) {
+		body[i] = pattern(HDRSIZE + i);
+	}
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* An empty buffer in the middle shouldn't matter. */
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = HDRSIZE;
+	iov[1].iov_base = NULL;
+	iov[1].iov_len = 0;
+	iov[2].iov_base = body;
+	iov[2].iov_len = BODYSIZE;
+	len = writev(fd, iov, 3);
+	if (len != TOTAL) {
+		fail("writev wrote the wrong number of bytes");
+	}
+	if (lseek(fd, 0, SEEK_CUR) != TOTAL) {
+		fail("writev left the offset in the wrong place");
+	}
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+	for (j = 0; j < 3; j++) {
+		memset(in[j], 0, sizeof(in[j]));
+		iov[j].iov_base = in[j];
+		iov[j].iov_len = sizeof(in[j]);
+	}
+	len = readv(fd, iov, 3);
+	if (len != TOTAL) {
+		fail("readv read the wrong number of bytes");
+	}
+	for (i = 0, j = 0, k = 0; i < TOTAL; i++) {
+		if (in[j][k] != pattern(i)) {
+			fail("readv got the wrong contents");
+		}
+		if (++k == sizeof(in[j])) {
+			j++;
+			k = 0;
+		}
+	}
+
+	/* At end of file, readv reads nothing. */
+	len = readv(fd, iov, 3);
+	if (len != 0) {
+		fail("readv at end of file read something");
+	}
+
+	if (writev(fd, iov, 0) != -1 || errno != EINVAL) {
+		fail("writev with no iovecs didn't fail with EINVAL");
+	}
+	if (readv(fd, iov, -1) != -1 || errno != EINVAL) {
+		fail("readv with a negative count didn't fail with EINVAL");
+	}
+	if (readv(fd, NULL, 1) != -1 || errno != EFAULT) {
+		fail("readv with a bad iovec array didn't fail with EFAULT");
+	}
+
+	close(fd);
+	remove(FILENAME);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/iovtest");
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * mmaptest.c
+ *
+ * Maps a file shared and private, and anonymous memory, and checks
+ * that the file's contents show up in memory, that changes to a
+ * shared mapping reach the file on msync and munmap and are seen
+ * across fork, and that changes to a private one don't.
+ */
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define PAGE_SIZE       4096
+#define NPAGES          4
+#define FILESIZE        (NPAGES * PAGE_SIZE - 100)  /* Last page is partial. */
+#define FILENAME        "mmaptest.dat"
+
+static char buf[NPAGES * PAGE_SIZE];
+
+static
+unsigned char
+pattern(unsigned i, unsigned round)
+{
+	return (unsigned char)(i * 7 + round);
+}
+
+static
+void
+fail(const char *msg)
+{
+	success(TEST161_FAIL, SECRET, "/testbin/mmaptest");
+	errx(1, "FAILED: %s", msg);
+}
+
+/*
+ * Read the whole file with read() and check it against ROUND.
+ */
+static
+void
+checkfile(int fd, unsigned round)
+{
+	ssize_t len;
+	unsigned i;
+
+	if (lseek(fd, 0, SEEK_SET) != 0) {
+		err(1, "lseek");
+	}
+	len = read(fd, buf, sizeof(buf));
+	if (len != FILESIZE) {
+		fail("file changed size");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if ((unsigned char)buf[i] != pattern(i, round)) {
+			fail("file has the wrong contents");
+		}
+	}
+}
+
+int
+main(void)
+{
+	unsigned char *p, *q;
+	unsigned i;
+	int fd, status;
+	pid_t pid;
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		buf[i] = pattern(i, 0);
+	}
+	if (write(fd, buf, FILESIZE) != FILESIZE) {
+		err(1, "write");
+	}
+
+	tprintf("Mapping the file shared...\n");
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (p[i] != pattern(i, 0)) {
+			fail("mapping doesn't match the file");
+		}
+	}
+	for (i = FILESIZE; i < NPAGES * PAGE_SIZE; i++) {
+		if (p[i] != 0) {
+			fail("past the end of the file isn't zero");
+		}
+	}
+
+	tprintf("Writing through the mapping...\n");
+	for (i = 0; i < FILESIZE; i++) {
+		p[i] = pattern(i, 1);
+	}
+	if (msync(p, FILESIZE, MS_SYNC)) {
+		err(1, "msync");
+	}
+	checkfile(fd, 1);
+
+	tprintf("Writing through the mapping from a child...\n");
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i = 0; i < FILESIZE; i++) {
+			p[i] = pattern(i, 4);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fail("child failed");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (p[i] != pattern(i, 4)) {
+			fail("parent doesn't see the child's changes");
+		}
+	}
+	checkfile(fd, 4);
+
+	/* Change it again; munmap has to write it back too. */
+	for (i = 0; i < FILESIZE; i++) {
+		p[i] = pattern(i, 2);
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	checkfile(fd, 2);
+
+	/* None of these pages is in memory when the child is forked. */
+	tprintf("Forking before touching a shared mapping...\n");
+	p = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		for (i = 0; i < FILESIZE; i++) {
+			p[i] = pattern(i, 5);
+		}
+		_exit(0);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		fail("child failed");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (p[i] != pattern(i, 5)) {
+			fail("parent doesn't see the child's changes");
+		}
+	}
+	checkfile(fd, 5);
+
+	/* Put it back for the private mapping. */
+	for (i = 0; i < FILESIZE; i++) {
+		p[i] = pattern(i, 2);
+	}
+	if (munmap(p, FILESIZE)) {
+		err(1, "munmap");
+	}
+	checkfile(fd, 2);
+
+	tprintf("Mapping the file private...\n");
+	q = mmap(NULL, FILESIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (q == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	for (i = 0; i < FILESIZE; i++) {
+		if (q[i] != pattern(i, 2)) {
+			fail("private mapping doesn't match the file");
+		}
+		q[i] = pattern(i, 3);
+	}
+	if (munmap(q, FILESIZE)) {
+		err(1, "munmap");
+	}
+	checkfile(fd, 2);
+
+	tprintf("Mapping anonymous memory...\n");
+	q = mmap(NULL, NPAGES * PAGE_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANON, -1, 0);
+	if (q == MAP_FAILED) {
+		err(1, "mmap");
+	}
+	if (mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANON, -1, 0) != MAP_FAILED ||
+	    errno != EINVAL) {
+		fail("shared anonymous mapping didn't fail with EINVAL");
+	}
+	for (i = 0; i < NPAGES * PAGE_SIZE; i++) {
+		if (q[i] != 0) {
+			fail("anonymous memory isn't zero");
+		}
+	}
+
+	/* Punch a hole in the middle; the rest stays. */
+	memset(q, 0x5a, NPAGES * PAGE_SIZE);
+	if (munmap(q + PAGE_SIZE, PAGE_SIZE)) {
+		err(1, "munmap");
+	}
+	if (q[0] != 0x5a || q[2 * PAGE_SIZE] != 0x5a) {
+		fail("munmap took too much");
+	}
+	if (munmap(q, NPAGES * PAGE_SIZE)) {
+		err(1, "munmap");
+	}
+
+	close(fd);
+	remove(FILENAME);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/mmaptest");
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * preadbench.c
+ *
+ * Random-read benchmark for pread. Writes a file of numbered blocks
+ * with pwrite, then forks processes that all share one descriptor
+ * and each pread blocks at random offsets, checking every block they
+ * get. Since pread doesn't use the shared offset, the processes never
+ * see each other's seeks.
+ *
+ * Usage: preadbench [nprocs [nreads]]
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+#include <test161/test161.h>
+
+#define BLOCKSIZE       4096
+#define NBLOCKS         64
+#define MAXPROCS        16
+#define FILENAME        "preadbench.dat"
+
+static unsigned block[BLOCKSIZE / sizeof(unsigned)];
+
+static
+void
+fail(const char *msg)
+{
+	success(TEST161_FAIL, SECRET, "/testbin/preadbench");
+	errx(1, "FAILED: %s", msg);
+}
+
+static
+void
+fillblock(unsigned n)
+{
+	unsigned i;
+
+	for (i = 0; i < BLOCKSIZE / sizeof(unsigned); i++) {
+		block[i] = n * 1000 + i;
+	}
+}
+
+/*
+ * One reader: NREADS random blocks. Exits nonzero on a bad block.
+ */
+static
+void
+reader(int fd, unsigned me, unsigned nreads)
+{
+	unsigned r, n, i;
+	ssize_t len;
+
+	srandom(me + 1);
+	for (r = 0; r < nreads; r++) {
+		n = random() % NBLOCKS;
+		len = pread(fd, block, BLOCKSIZE, (off_t)n * BLOCKSIZE);
+		if (len != BLOCKSIZE) {
+			warnx("reader %u: short pread of block %u", me, n);
+			_exit(1);
+		}
+		for (i = 0; i < BLOCKSIZE / sizeof(unsigned); i++) {
+			if (block[i] != n * 1000 + i) {
+				warnx("reader %u: block %u has the wrong contents",
+				      me, n);
+				_exit(1);
+			}
+		}
+	}
+	_exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	unsigned nprocs = 4, nreads = 256;
+	pid_t pids[MAXPROCS];
+	time_t s0, s1;
+	unsigned long ns0, ns1, ms, kb;
+	unsigned i;
+	int fd, status, bad;
+
+	if (argc > 1) {
+		nprocs = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		nreads = atoi(argv[2]);
+	}
+	if (nprocs < 1 || nprocs > MAXPROCS || nreads < 1) {
+		errx(1, "Usage: preadbench [nprocs (1-%d) [nreads]]", MAXPROCS);
+	}
+
+	fd = open(FILENAME, O_RDWR | O_CREAT | O_TRUNC);
+	if (fd < 0) {
+		err(1, "%s", FILENAME);
+	}
+
+	/* Back to front, so the file is sparse until the end. */
+	for (i = NBLOCKS; i-- > 0; ) {
+		fillblock(i);
+		if (pwrite(fd, block, BLOCKSIZE, (off_t)i * BLOCKSIZE) !=
+		    BLOCKSIZE) {
+			err(1, "pwrite");
+		}
+	}
+	if (lseek(fd, 0, SEEK_CUR) != 0) {
+		fail("pwrite moved the file offset");
+	}
+
+	__time(&s0, &ns0);
+	for (i = 0; i < nprocs; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0) {
+			err(1, "fork");
+		}
+		if (pids[i] == 0) {
+			reader(fd, i, nreads);
+		}
+	}
+
+	bad = 0;
+	for (i = 0; i < nprocs; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			err(1, "waitpid");
+		}
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			bad = 1;
+		}
+	}
+	__time(&s1, &ns1);
+
+	close(fd);
+	remove(FILENAME);
+
+	if (bad) {
+		fail("a reader got a bad block");
+	}
+
+	ms = (s1 - s0) * 1000 + ns1 / 1000000 - ns0 / 1000000;
+	kb = (unsigned long)nprocs * nreads * (BLOCKSIZE / 1024);
+	printf("%u processes x %u reads of %d bytes: %lu ms, %lu KB/s\n",
+	       nprocs, nreads, BLOCKSIZE, ms, ms == 0 ? 0 : kb * 1000 / ms);
+
+	success(TEST161_SUCCESS, SECRET, "/testbin/preadbench");
+	return 0;
+}